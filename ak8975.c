@@ -1,5 +1,7 @@
 #include "ak8975.h"
 
+static void ak8975_queue_callback( I2CTransaction *transaction );
+
 char ak8975_init( AK8975Unit *unit, uint8_t address )
 {
     /* init and test */
@@ -7,6 +9,16 @@ char ak8975_init( AK8975Unit *unit, uint8_t address )
 
     unit->address = address;
 
+    /* キュー読み込み準備 */
+    unit->transaction.slave    = address;
+    unit->transaction.callback = ak8975_queue_callback;
+    unit->transaction.user     = unit;
+    unit->transaction.speed    = NULL;
+    unit->transaction.status   = I2CSuccess;
+    unit->mode    = 0x01;
+    unit->fresh   = 0;
+    unit->restart = 0;
+
     /* Read device ID */
     if ( !i2c_read_register( unit->address, 0x00, &data, 1, I2CPolling ) ) {
         return 0;
@@ -37,6 +49,14 @@ char ak8975_init( AK8975Unit *unit, uint8_t address )
         return 0;
     }
 
+    /*
+     * 補正倍率 ( ( coeff - 128 ) * 0.5 ) / 128 + 1 = ( coeff + 128 ) / 256
+     * 分子だけ持っておけば整数の乗算と256での割り算で浮動小数点と同じ結果になる
+     */
+    unit->mul_x = unit->coeff_x + 128;
+    unit->mul_y = unit->coeff_y + 128;
+    unit->mul_z = unit->coeff_z + 128;
+
     /* モード0へ */
     data = 0x00;
 
@@ -104,10 +124,124 @@ char ak8975_read( AK8975Unit *unit )
     return 1;
 }
 
+char ak8975_poll_read( AK8975Unit *unit )
+{
+    /* ST1, 測定値, ST2を続けて読み，DRDYなら分配して1 ( ST2まで読むのでデータ保護も解除される ) */
+    uint8_t data[8];
+
+    if ( !i2c_read_register( unit->address, 0x02, data, 8, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !( data[0] & 0x01 ) ) {
+        return 0;
+    }
+
+    unit->x = data[1] | ( data[2] << 8 );
+    unit->y = data[3] | ( data[4] << 8 );
+    unit->z = data[5] | ( data[6] << 8 );
+
+    return 1;
+}
+
 void ak8975_calc_adjusted_h( AK8975Unit *unit )
 {
-    /* 補正値を使って補正済みHを計算 */
-    unit->adj_x = ( ( ( unit->coeff_x - 128 ) * 0.5 ) / 128 + 1 ) * unit->x;
-    unit->adj_y = ( ( ( unit->coeff_y - 128 ) * 0.5 ) / 128 + 1 ) * unit->y;
-    unit->adj_z = ( ( ( unit->coeff_z - 128 ) * 0.5 ) / 128 + 1 ) * unit->z;
+    /* 補正値を使って補正済みHを計算 ( 0方向への切り捨てはfloatからint16_tへの変換と同じ ) */
+    unit->adj_x = ( (int32_t)unit->mul_x * unit->x ) / 256;
+    unit->adj_y = ( (int32_t)unit->mul_y * unit->y ) / 256;
+    unit->adj_z = ( (int32_t)unit->mul_z * unit->z ) / 256;
+}
+
+static void ak8975_queue_callback( I2CTransaction *transaction )
+{
+    /* 割り込み中: データレディーなら次の測定を開始する */
+    AK8975Unit *unit = transaction->user;
+
+    switch ( transaction->address ) {
+    case 0x02:
+        /* ST1-ST2 */
+        if ( transaction->status == I2CSuccess && ( unit->buffer[0] & 0x01 ) ) {
+            unit->fresh = 1;
+
+            /* 測定開始 */
+            transaction->address = 0x0A;
+            transaction->rw      = I2CW;
+            transaction->data    = &unit->mode;
+            transaction->size    = 1;
+
+            if ( !i2c_queue_push( transaction ) ) {
+                unit->restart = 1;
+            }
+        }
+        break;
+
+    case 0x0A:
+        /* 測定開始に失敗していれば次回やり直す */
+        unit->restart = ( transaction->status != I2CSuccess );
+        break;
+
+    default:
+        break;
+    }
+}
+
+char ak8975_queue_read( AK8975Unit *unit )
+{
+    /* ST1-ST2読み込み ( 測定開始に失敗していれば測定開始 ) をキューに入れる */
+    if ( unit->restart ) {
+        unit->transaction.address = 0x0A;
+        unit->transaction.rw      = I2CW;
+        unit->transaction.data    = &unit->mode;
+        unit->transaction.size    = 1;
+    } else {
+        unit->transaction.address = 0x02;
+        unit->transaction.rw      = I2CR;
+        unit->transaction.data    = unit->buffer;
+        unit->transaction.size    = 8;
+    }
+
+    return i2c_queue_push( &unit->transaction );
+}
+
+char ak8975_queue_busy( AK8975Unit *unit )
+{
+    /* キュー読み込み中か */
+    return ( unit->transaction.status == I2CWorking );
+}
+
+char ak8975_queue_fetch( AK8975Unit *unit )
+{
+    /* キュー読み込みで新しいデータが来ていれば分配して1 */
+    if ( ak8975_queue_busy( unit ) || !unit->fresh ) {
+        return 0;
+    }
+
+    unit->x = unit->buffer[1] | ( unit->buffer[2] << 8 );
+    unit->y = unit->buffer[3] | ( unit->buffer[4] << 8 );
+    unit->z = unit->buffer[5] | ( unit->buffer[6] << 8 );
+    unit->fresh = 0;
+
+    return 1;
+}
+
+char ak8975_aux_enable( AK8975Unit *unit, MPU9150Unit *mpu, uint8_t delay )
+{
+    /* MPU9150にST1からST2までの8バイトを読ませて，CNTLに単発測定を書かせる */
+    return mpu9150_aux_enable( mpu, unit->address, 0x02, 8, 0x0A, unit->mode, delay );
+}
+
+char ak8975_aux_fetch( AK8975Unit *unit, MPU9150Unit *mpu )
+{
+    /* MPU9150のサンプルに新しい測定値が入っていれば分配して1 */
+    const uint8_t *data = mpu->ext;
+
+    if ( mpu->ext_size < 8 || !( data[0] & 0x01 ) ) {
+        return 0;
+    }
+
+    unit->x = data[1] | ( data[2] << 8 );
+    unit->y = data[3] | ( data[4] << 8 );
+    unit->z = data[5] | ( data[6] << 8 );
+
+    return 1;
 }
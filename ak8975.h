@@ -2,6 +2,7 @@
 #define AK8975_H_INCLUDED
 
 #include "i2c.h"
+#include "mpu9150.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,9 +14,19 @@ typedef struct {
     uint8_t coeff_x;
     uint8_t coeff_y;
     uint8_t coeff_z;
+    int16_t mul_x;          /* 感度補正倍率 ( coeff + 128 ) / 256 の分子 */
+    int16_t mul_y;
+    int16_t mul_z;
     int16_t adj_x;
     int16_t adj_y;
     int16_t adj_z;
+
+    /* キュー読み込み用 */
+    I2CTransaction transaction;
+    uint8_t buffer[8];      /* ST1, HXL-HZH, ST2 */
+    uint8_t mode;
+    volatile char fresh;
+    volatile char restart;
 } AK8975Unit;
 
 char ak8975_init( AK8975Unit *unit, uint8_t address );
@@ -23,8 +34,24 @@ char ak8975_start( AK8975Unit *unit );
 char ak8975_data_ready( AK8975Unit *unit );
 char ak8975_over_flow( AK8975Unit *unit );
 char ak8975_read( AK8975Unit *unit );
+char ak8975_poll_read( AK8975Unit *unit );      /* ST1からST2まで1回で読む．新しい測定値なら1 */
 void ak8975_calc_adjusted_h( AK8975Unit *unit );
 
+/* TWI割り込みキューで ST1-ST2読み込み -> ( データレディーなら ) 次の測定開始 を行う */
+char ak8975_queue_read( AK8975Unit *unit );
+char ak8975_queue_busy( AK8975Unit *unit );
+char ak8975_queue_fetch( AK8975Unit *unit );
+
+/*
+ * MPU9150の補助I2Cマスター経由 ( ak8975_initの後に呼ぶ．以後直接はアクセスできない )
+ * MPU9150が毎サンプルST1-ST2を読み，( 1 + delay ) サンプルごとに単発測定を開始する．
+ * 測定が終わって最初に読まれたサンプルだけST1のDRDYが立つので，
+ * mpu9150_fifo_fetch / mpu9150_queue_fetch の後にak8975_aux_fetchを呼ぶと新しい測定値のときだけ1になる．
+ * delayは測定時間7.3msより長くなるように ( 1kHzなら9で100Hz )
+ */
+char ak8975_aux_enable( AK8975Unit *unit, MPU9150Unit *mpu, uint8_t delay );
+char ak8975_aux_fetch( AK8975Unit *unit, MPU9150Unit *mpu );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,87 @@
+#include "decimate.h"
+
+void decimate_init( Decimator *dec, int32_t *sums, uint8_t values, uint8_t width, uint16_t ratio )
+{
+    /* 初期化 */
+    dec->sums   = sums;
+    dec->values = values;
+    dec->width  = width;
+
+    decimate_set_ratio( dec, ratio );
+}
+
+void decimate_set_ratio( Decimator *dec, uint16_t ratio )
+{
+    /* 間引く数 ( 32bitの値は合計が溢れないように ) */
+    if ( dec->width == 4 && ratio > DECIMATE_RATIO_MAX_32 ) {
+        ratio = DECIMATE_RATIO_MAX_32;
+    }
+
+    dec->ratio = ratio;
+
+    decimate_reset( dec );
+}
+
+void decimate_reset( Decimator *dec )
+{
+    /* 合計を0に */
+    uint8_t i;
+
+    for ( i = 0; i < dec->values; i++ ) {
+        dec->sums[i] = 0;
+    }
+
+    dec->count = 0;
+}
+
+char decimate_add( Decimator *dec, uint8_t *data, uint32_t *clock )
+{
+    /* 値を足して，ratio個たまったら四捨五入した平均を書き戻す */
+    int32_t value;
+    int32_t half;
+    uint8_t *p;
+    uint8_t i;
+
+    if ( dec->ratio <= 1 ) {
+        return dec->ratio;
+    }
+
+    if ( dec->count == 0 ) {
+        dec->first_clock = *clock;
+    }
+
+    for ( i = 0, p = data; i < dec->values; i++, p += dec->width ) {
+        if ( dec->width == 4 ) {
+            value = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        } else {
+            value = (int16_t)( p[0] | p[1] << 8 );
+        }
+
+        dec->sums[i] += value;
+    }
+
+    if ( ++dec->count < dec->ratio ) {
+        return 0;
+    }
+
+    half = dec->ratio / 2;
+
+    for ( i = 0, p = data; i < dec->values; i++, p += dec->width ) {
+        value = dec->sums[i];
+        value = ( value + ( ( value < 0 ) ? -half : half ) ) / (int32_t)dec->ratio;
+
+        p[0] = value;
+        p[1] = value >> 8;
+
+        if ( dec->width == 4 ) {
+            p[2] = value >> 16;
+            p[3] = value >> 24;
+        }
+    }
+
+    *clock = dec->first_clock + ( *clock - dec->first_clock ) / 2;
+
+    decimate_reset( dec );
+
+    return 1;
+}
@@ -0,0 +1,45 @@
+/*
+ * レコードの間引き ( 平均 )
+ *
+ * レコードの中身 ( リトルエンディアンの符号付き整数がwidthバイトずつvalues個 ) をratio個ごとに平均して1つにします．
+ * 平均した値は渡した中身に書き戻し，時刻は平均したサンプルの最初と最後の真ん中にします．
+ * 合計は32bitなので，4バイトの値 ( 気圧は24bit ) はDECIMATE_RATIO_MAX_32個までにします．
+ *
+ */
+
+#ifndef DECIMATE_H_INCLUDED
+#define DECIMATE_H_INCLUDED
+
+#include <stdint.h>
+
+#define DECIMATE_RATIO_MAX_32 256
+
+typedef struct {
+    uint16_t ratio;             /* 何サンプルを1つにするか ( 0は出さない，1はそのまま ) */
+    uint16_t count;             /* たまったサンプル数 */
+    uint32_t first_clock;       /* たまった最初のサンプルの時刻 */
+    uint8_t values;             /* 値の数 */
+    uint8_t width;              /* 値のバイト数 ( 2か4 ) */
+    int32_t *sums;              /* 値ごとの合計 ( values個 ) */
+} Decimator;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void decimate_init( Decimator *dec, int32_t *sums, uint8_t values, uint8_t width, uint16_t ratio );
+
+/* 間引く数を変える ( たまった分は捨てる ) */
+void decimate_set_ratio( Decimator *dec, uint16_t ratio );
+
+/* たまった分を捨てる */
+void decimate_reset( Decimator *dec );
+
+/* 1サンプル追加．ratio個たまったらdataとclockを平均にして1 */
+char decimate_add( Decimator *dec, uint8_t *data, uint32_t *clock );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
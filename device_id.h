@@ -5,11 +5,55 @@
 #define LOG_SIGNATURE_OLD 0x3E      /* ログファイルのデーターごとの先頭バイトシグネチャ (古い) */
 #define LOG_SIGNATURE 0xAE          /* ログファイルのデーターごとの先頭バイトシグネチャ */
 #define LOG_END_SIGNATURE 0xCE      /* ログデーター終了フラッグ */
+
+/*
+ * ログ形式v2
+ *  ファイル先頭 : DEVICE_LOG_V2_SIGNATURE, 有効デバイス ( v1と同じ2バイト )
+ *  時刻同期     : LOG_V2_SYNC, 時刻4バイト ( リトルエンディアン )
+ *                 全IDの前の時刻をこの時刻にする．ファイル先頭と1秒ごとに入る
+ *  レコード     : LOG_V2_RECORD | ID, 時刻の差, データ
+ *                 時刻の差は同じIDの前のレコード ( 同期の後なら同期の時刻 ) からの差をzigzag符号化して
+ *                 下位7bitずつ並べたもの ( 続きがあればMSBが1 )．データサイズはIDで決まっている
+ *                 ( ID_MPU9150_IMU_PACKだけは時刻の差の後にサイズ1バイト，中身はimu_pack.h )
+ *  終了         : LOG_END_SIGNATURE
+ */
+#define DEVICE_LOG_V2_SIGNATURE 0x8F    /* ログファイル先頭のシグネチャ ( v2 ) */
+#define LOG_V2_SYNC 0x9E                /* v2の時刻同期 */
+#define LOG_V2_RECORD 0xB0              /* v2のレコード ( 下位4bitがID ) */
+#define LOG_V2_SYNC_SIZE 5
 #define TRANSMIT_START 0xA5
 #define TRANSMIT_STOP  0xB5
 #define TRANSMIT_HANDSHAKE 0xC5
 #define TRANSMIT_HANDSHAKE_ACK 0xC6
 
+/*
+ * ボーレート変更 ( 送信中でないとき )
+ *  PC     : TRANSMIT_BAUD, ボーレート番号
+ *  sensor3: TRANSMIT_HANDSHAKE_ACK, 切り替えるボーレート番号 ( 受け付けなければ今の番号 ) を今のボーレートで返し，
+ *           送り終えてから切り替える
+ *  PC     : 応答を受けたら切り替えて，新しいボーレートでTRANSMIT_HANDSHAKEを送る
+ * 切り替えてからTRANSMIT_BAUD_TIMEOUT以内にTRANSMIT_HANDSHAKEが届かなければsensor3は9600bpsに戻ります．
+ */
+#define TRANSMIT_BAUD 0xC7
+#define TRANSMIT_BAUD_9600  0
+#define TRANSMIT_BAUD_250K  1       /* 8MHz, U2Xで誤差なし */
+#define TRANSMIT_BAUD_500K  2
+#define TRANSMIT_BAUD_1M    3
+#define TRANSMIT_BAUD_COUNT 4
+#define TRANSMIT_BAUD_TIMEOUT 10000 /* 100us単位 ( 1秒 ) */
+
+/*
+ * プレビュー ( SDには全部書いたまま，USARTへは間引いて送る )
+ *  TRANSMIT_PREVIEW_START : TRANSMIT_STARTの代わりに送ると間引いて送信を始める ( 送信中なら切り替える )
+ *  TRANSMIT_PREVIEW_RATIO, ID, サンプル数 ( 2バイト，リトルエンディアン )
+ *                         : IDのレコードをサンプル数ごとに平均して1つにする ( 0は送らない，1はそのまま )
+ * 間引けるのはID_LPS331AP, ID_LPS331AP_TEMP, ID_MPU9150_IMU, ID_AK8975で，ほかのIDは送りません．
+ * 平均したレコードの時刻は最初と最後のサンプルの真ん中です．
+ * 既定はIMUと地磁気が10Hz，気圧と温度が1Hzになる数です．
+ */
+#define TRANSMIT_PREVIEW_START 0xA6
+#define TRANSMIT_PREVIEW_RATIO 0xC8
+
 typedef enum {
     ID_ADXL345,
     ID_LPS331AP,
@@ -22,6 +66,8 @@ typedef enum {
     ID_AK8975,
     ID_GPS,
     ID_LPS25H,
+    ID_MPU9150_IMU,     /* 加速度, ジャイロ, 温度 ( v2のみ ) */
+    ID_MPU9150_IMU_PACK,/* ID_MPU9150_IMUを圧縮したブロック ( v2のみ ) */
     DEVICE_COUNT,
 } SensorDeviceId;
 
@@ -33,6 +79,7 @@ typedef enum {
     DEV_TEMP  = 0x10,
     DEV_GPS   = 0x20,
     DEV_SD    = 0x40,
+    DEV_PRESS_TEMP = 0x80,
 } Devices;
 
 #endif
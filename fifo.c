@@ -0,0 +1,73 @@
+#include "fifo.h"
+
+void fifo_init( Fifo *fifo, uint8_t *buffer, uint8_t size )
+{
+    /* 初期化 ( sizeは2のべき乗 ) */
+    fifo->buffer = buffer;
+    fifo->mask   = size - 1;
+    fifo->head   = 0;
+    fifo->tail   = 0;
+}
+
+uint8_t fifo_count( Fifo *fifo )
+{
+    /* 入っている数 */
+    return (uint8_t)( fifo->head - fifo->tail );
+}
+
+uint8_t fifo_space( Fifo *fifo )
+{
+    /* 空き */
+    return fifo->mask + 1 - fifo_count( fifo );
+}
+
+char fifo_put( Fifo *fifo, uint8_t data )
+{
+    /* 1バイト書く ( いっぱいなら0 ) */
+    uint8_t head = fifo->head;
+
+    if ( (uint8_t)( head - fifo->tail ) > fifo->mask ) {
+        return 0;
+    }
+
+    fifo->buffer[head & fifo->mask] = data;
+    fifo->head = head + 1;
+
+    return 1;
+}
+
+uint8_t fifo_write( Fifo *fifo, const void *src, uint8_t count )
+{
+    /* 入るだけ書いてから1回でheadを進める */
+    const uint8_t *p = src;
+    uint8_t head = fifo->head;
+    uint8_t space = fifo_space( fifo );
+    uint8_t i;
+
+    if ( count > space ) {
+        count = space;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        fifo->buffer[( head + i ) & fifo->mask] = p[i];
+    }
+
+    fifo->head = head + count;
+
+    return count;
+}
+
+char fifo_get( Fifo *fifo, uint8_t *data )
+{
+    /* 1バイト読む ( 空なら0 ) */
+    uint8_t tail = fifo->tail;
+
+    if ( tail == fifo->head ) {
+        return 0;
+    }
+
+    *data = fifo->buffer[tail & fifo->mask];
+    fifo->tail = tail + 1;
+
+    return 1;
+}
@@ -0,0 +1,42 @@
+/*
+ * 1バイト単位のリングバッファー
+ *
+ * 書く側と読む側がそれぞれ1つ ( 例えばメインループと割り込み ) なら，割り込み禁止なしで使えます．
+ * 書く側はデーターを置いてからhead，読む側は取り出してからtailだけを進めます．( どちらも8bitなので1命令で書ける )
+ * 大きさは2のべき乗で128まで．( headとtailは回り続けて，差が入っている数 )
+ *
+ */
+
+#ifndef FIFO_H_INCLUDED
+#define FIFO_H_INCLUDED
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint8_t *buffer;
+    uint8_t mask;               /* 大きさ - 1 */
+    volatile uint8_t head;      /* 次に書く位置 ( 書く側だけが進める ) */
+    volatile uint8_t tail;      /* 次に読む位置 ( 読む側だけが進める ) */
+} Fifo;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void fifo_init( Fifo *fifo, uint8_t *buffer, uint8_t size );
+
+uint8_t fifo_count( Fifo *fifo );   /* 入っている数 */
+uint8_t fifo_space( Fifo *fifo );   /* 空き */
+
+/* 書く側 */
+char fifo_put( Fifo *fifo, uint8_t data );
+uint8_t fifo_write( Fifo *fifo, const void *src, uint8_t count );  /* 入った分のバイト数を返す */
+
+/* 読む側 */
+char fifo_get( Fifo *fifo, uint8_t *data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#include "frame.h"
+#include <string.h>
+
+void frame_init( Frame *frame )
+{
+    /* 初期化 */
+    frame->seq  = 0;
+    frame->size = 0;
+}
+
+char frame_add( Frame *frame, const void *src, uint8_t count )
+{
+    /* 番号の後ろに中身をためる */
+    if ( frame->size + count > FRAME_DATA_MAX ) {
+        return 0;
+    }
+
+    memcpy( &frame->buffer[2 + frame->size], src, count );
+    frame->size += count;
+
+    return 1;
+}
+
+uint8_t *frame_encode( Frame *frame, uint8_t *size )
+{
+    /* 番号とCRCを置いて，0を次の0 ( 最後は区切り ) までの距離に置き換える */
+    uint8_t *buffer = frame->buffer;
+    uint16_t crc = 0xFFFF;
+    uint8_t length;
+    uint8_t last;
+    uint8_t i;
+
+    buffer[1] = frame->seq++;
+    length    = 1 + frame->size;
+
+    for ( i = 1; i <= length; i++ ) {
+        crc = frame_crc16( crc, buffer[i] );
+    }
+
+    buffer[++length] = crc >> 8;
+    buffer[++length] = crc;
+
+    /* COBS ( 254バイト未満なのでブロックは1つ ) */
+    last = 0;
+
+    for ( i = 1; i <= length; i++ ) {
+        if ( buffer[i] == 0 ) {
+            buffer[last] = i - last;
+            last = i;
+        }
+    }
+
+    buffer[last]       = length + 1 - last;
+    buffer[length + 1] = 0;
+
+    frame->size = 0;
+    *size = length + 2;
+
+    return buffer;
+}
+
+char frame_decode( uint8_t *buffer, uint16_t length, uint8_t *seq, uint8_t **data, uint16_t *size )
+{
+    /* COBSを戻してCRCを確かめる */
+    uint16_t crc = 0xFFFF;
+    uint16_t in = 0;
+    uint16_t out = 0;
+    uint8_t code;
+    uint8_t i;
+
+    while ( in < length ) {
+        code = buffer[in++];
+
+        if ( code == 0 ) {
+            return 0;
+        }
+
+        for ( i = 1; i < code; i++ ) {
+            if ( in >= length || buffer[in] == 0 ) {
+                return 0;
+            }
+
+            buffer[out++] = buffer[in++];
+        }
+
+        /* 0xFFは後ろに0がないブロック */
+        if ( code != 0xFF && in < length ) {
+            buffer[out++] = 0;
+        }
+    }
+
+    /* 番号とCRC */
+    if ( out < 3 ) {
+        return 0;
+    }
+
+    for ( in = 0; in < out - 2; in++ ) {
+        crc = frame_crc16( crc, buffer[in] );
+    }
+
+    if ( crc != ( (uint16_t)buffer[out - 2] << 8 | buffer[out - 1] ) ) {
+        return 0;
+    }
+
+    *seq  = buffer[0];
+    *data = buffer + 1;
+    *size = out - 3;
+
+    return 1;
+}
+
+uint16_t frame_crc16( uint16_t crc, uint8_t data )
+{
+    /* CRC-16/CCITT ( 0x1021 ) を1バイト分 ( avr-libcの_crc_xmodem_updateと同じ ) */
+    crc  = ( crc >> 8 ) | ( crc << 8 );
+    crc ^= data;
+    crc ^= ( crc & 0xFF ) >> 4;
+    crc ^= crc << 12;
+    crc ^= ( crc & 0xFF ) << 5;
+
+    return crc;
+}
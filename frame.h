@@ -0,0 +1,58 @@
+/*
+ * USART送信用のフレーム ( COBS, 番号, CRC16 )
+ *
+ * 中身はログ形式v2のバイト列をそのまま区切ったもので，つなげるとSDのログと同じになります．
+ * フレーム : COBS( 番号, 中身, CRC16 ), 0x00
+ *  番号  : フレームごとに1ずつ増える
+ *  CRC16 : 番号と中身のCRC-16/CCITT ( 0x1021, 初期値0xFFFF ) 上位から
+ * COBSで0x00が区切りにしか出てこないので，受信側はバイトが欠けても次の0x00から読み直せます．
+ * 番号が飛んだら，その間のレコードの時刻の差がつながらないので次の時刻同期まで読み捨ててください．
+ * ( 送る側で入らなかったレコードは，フレームには入れずに落として時刻同期から送り直します )
+ *
+ * 符号化はバッファーの中でそのまま行うので，RAMはフレーム1つ分だけです．
+ * frame_decodeはPC側で使います．
+ *
+ */
+
+#ifndef FRAME_H_INCLUDED
+#define FRAME_H_INCLUDED
+
+#include <stdint.h>
+
+#define FRAME_DATA_MAX      40      /* 1フレームの中身 ( 253まで ) */
+#define FRAME_OVERHEAD      5       /* COBS, 番号, CRC16, 区切り */
+#define FRAME_ENCODED_MAX   ( FRAME_DATA_MAX + FRAME_OVERHEAD )
+
+typedef struct {
+    uint8_t seq;                            /* 次のフレームの番号 */
+    uint8_t size;                           /* たまった中身 */
+    uint8_t buffer[FRAME_ENCODED_MAX];      /* COBS, 番号, 中身, CRC16, 区切り */
+} Frame;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void frame_init( Frame *frame );
+
+/* 中身を追加．入らなければ0 ( 何もしない ) */
+char frame_add( Frame *frame, const void *src, uint8_t count );
+
+/*
+ * たまった中身を符号化して先頭を返す ( sizeに区切りまでの長さ )．
+ * 番号を進めて中身を空にするので，次のframe_addまでに送ってください．
+ */
+uint8_t *frame_encode( Frame *frame, uint8_t *size );
+
+/*
+ * 区切りを除いた1フレームをその場で戻す．CRCが合えば番号と中身 ( dataからsize ) を返して1
+ */
+char frame_decode( uint8_t *buffer, uint16_t length, uint8_t *seq, uint8_t **data, uint16_t *size );
+
+uint16_t frame_crc16( uint16_t crc, uint8_t data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,37 +1,33 @@
 #include "i2c.h"
+#include <avr/interrupt.h>
+#include <util/delay.h>
 
 /* モジュール内変数 */
 static I2CUnit unit;
 static void (*auto_callback)( void ) = NULL;
-
-void i2c_init_master( uint8_t baud, I2CPrescale prescale, I2CPin pullup, char int_enable )
+static I2CQueue queue;
+static I2CSpeed default_speed;
+static I2CDeviceSpeed device_speed[I2C_DEVICE_SPEED_COUNT];
+static uint8_t device_speed_count;
+static volatile uint8_t ticks;
+static uint8_t timeout_ticks = I2C_DEFAULT_TIMEOUT;
+
+static void i2c_queue_start_next( void );
+static void i2c_queue_pop( I2CStatus status );
+static void i2c_queue_finish( I2CStatus status );
+static void i2c_queue_abort( void );
+static char i2c_wait_queue( void );
+static I2CStatus i2c_wait( I2CProcessMode mode );
+static char i2c_auto_write_next( void );
+static void i2c_apply_speed( uint8_t slave, const I2CSpeed *speed );
+
+void i2c_init_master( uint32_t frequency, I2CPin pullup, char int_enable )
 {
     /* マスターモードで初期化 */
 
     /* 速度設定 */
-    TWBR = baud;
-
-    switch ( prescale ) {
-    case I2CPrescale1:
-        TWSR = 0;
-        break;
-
-    case I2CPrescale4:
-        TWSR = 1;
-        break;
-
-    case I2CPrescale16:
-        TWSR = 2;
-        break;
-
-    case I2CPrescale64:
-        TWSR = 3;
-        break;
-
-    default:
-        TWSR = 3;
-        break;
-    }
+    device_speed_count = 0;
+    i2c_set_frequency( frequency );
 
     /* 有効化 */
     i2c_enable( 1 );
@@ -57,6 +53,199 @@ void i2c_init_master( uint8_t baud, I2CPrescale prescale, I2CPin pullup, char in
     /* 状態を初期化 */
     unit.step = I2CStepNone;
     unit.side = I2CMaster;
+
+    queue.head    = 0;
+    queue.count   = 0;
+    queue.step    = I2CQueueStepIdle;
+    queue.timeout = 0;
+}
+
+void i2c_tick( void )
+{
+    /* 周期割り込みから呼ばれる．キューのトランザクションが時間切れなら印を付けるだけ ( 復旧はi2c_poll ) */
+    ticks++;
+
+    if ( queue.step != I2CQueueStepIdle && queue.step != I2CQueueStepFinish && !queue.timeout ) {
+        if ( ++queue.elapsed >= timeout_ticks ) {
+            queue.timeout = 1;
+        }
+    }
+}
+
+void i2c_poll( void )
+{
+    /* メインループから呼ぶ．時間切れのトランザクションがあればバスを復旧して次へ */
+    uint8_t sreg;
+
+    if ( !queue.timeout ) {
+        return;
+    }
+
+    sreg = SREG;
+    cli();
+
+    /* 印を付けた後に終わっていれば何もしない */
+    if ( !queue.timeout ) {
+        SREG = sreg;
+        return;
+    }
+
+    /* これ以上TWI割り込みで進まないように止める */
+    TWCR       = 0;
+    queue.step = I2CQueueStepFinish;
+
+    SREG = sreg;
+
+    i2c_queue_abort();
+}
+
+void i2c_set_timeout( uint8_t timeout )
+{
+    /* タイムアウトをtick数で指定 */
+    timeout_ticks = timeout;
+}
+
+void i2c_recover_bus( void )
+{
+    /* SDAを握ったままのスレーブを解放させる ( SCLを最大9回動かしてSTOP ) */
+    uint8_t portc;
+    uint8_t twbr, twsr;
+    uint8_t i;
+
+    twbr  = TWBR;
+    twsr  = TWSR & 0x03;
+    portc = PORTC & ( _BV( PC4 ) | _BV( PC5 ) );
+
+    /* TWIを止めてピンをオープンドレインとして手動で動かす ( DDR=1でL，DDR=0で解放 ) */
+    TWCR  = 0;
+    PORTC &= ~( _BV( PC4 ) | _BV( PC5 ) );
+    DDRC  &= ~( _BV( PC4 ) | _BV( PC5 ) );
+
+    for ( i = 0; i < 9 && !( PINC & _BV( PC4 ) ); i++ ) {
+        DDRC |= _BV( PC5 );
+        _delay_us( 5 );
+        DDRC &= ~_BV( PC5 );
+        _delay_us( 5 );
+    }
+
+    /* STOP : SCL=LでSDAをLにして，SCL→SDAの順に解放 */
+    DDRC |= _BV( PC5 );
+    _delay_us( 5 );
+    DDRC |= _BV( PC4 );
+    _delay_us( 5 );
+    DDRC &= ~_BV( PC5 );
+    _delay_us( 5 );
+    DDRC &= ~_BV( PC4 );
+    _delay_us( 5 );
+
+    /* 再初期化 */
+    PORTC |= portc;
+    TWBR = twbr;
+    TWSR = twsr;
+    TWCR = _BV( TWEN );
+
+    unit.step     = I2CStepNone;
+    unit.complete = I2CTimeout;
+}
+
+char i2c_calc_speed( uint32_t frequency, I2CSpeed *speed )
+{
+    /* frequencyを超えない最も速いTWBR/Prescaleを計算 ( 遅すぎて作れなければ最低速にして0 ) */
+    uint32_t div;
+    uint32_t twbr;
+    uint8_t prescale;
+
+    if ( frequency == 0 ) {
+        speed->twbr     = 255;
+        speed->prescale = I2CPrescale64;
+        return 0;
+    }
+
+    /* F_CPU / frequency = 16 + 2 * TWBR * 4^prescale を切り上げで解く */
+    div = ( F_CPU + frequency - 1 ) / frequency;
+
+    if ( div <= 16 ) {
+        speed->twbr     = 0;
+        speed->prescale = I2CPrescale1;
+        return 1;
+    }
+
+    div -= 16;
+
+    for ( prescale = 0; prescale < 4; prescale++ ) {
+        twbr = ( div + ( 2UL << ( 2 * prescale ) ) - 1 ) >> ( 1 + 2 * prescale );
+
+        if ( twbr <= 255 ) {
+            speed->twbr     = twbr;
+            speed->prescale = prescale;
+            return 1;
+        }
+    }
+
+    speed->twbr     = 255;
+    speed->prescale = I2CPrescale64;
+
+    return 0;
+}
+
+void i2c_set_frequency( uint32_t frequency )
+{
+    /* 標準のバス速度を設定 */
+    i2c_calc_speed( frequency, &default_speed );
+    i2c_apply_speed( 0xFF, NULL );
+}
+
+char i2c_set_device_frequency( uint8_t slave, uint32_t frequency )
+{
+    /* スレーブごとのバス速度を登録 */
+    uint8_t i;
+
+    for ( i = 0; i < device_speed_count; i++ ) {
+        if ( device_speed[i].slave == slave ) {
+            break;
+        }
+    }
+
+    /* 登録解除 */
+    if ( frequency == 0 ) {
+        if ( i < device_speed_count ) {
+            device_speed[i] = device_speed[--device_speed_count];
+        }
+
+        return 1;
+    }
+
+    if ( i == device_speed_count ) {
+        if ( device_speed_count >= I2C_DEVICE_SPEED_COUNT ) {
+            return 0;
+        }
+
+        device_speed_count++;
+    }
+
+    device_speed[i].slave = slave;
+
+    return i2c_calc_speed( frequency, &device_speed[i].speed );
+}
+
+static void i2c_apply_speed( uint8_t slave, const I2CSpeed *speed )
+{
+    /* START前にスレーブに合わせてTWBR/Prescaleを切り替える */
+    uint8_t i;
+
+    if ( speed == NULL ) {
+        speed = &default_speed;
+
+        for ( i = 0; i < device_speed_count; i++ ) {
+            if ( device_speed[i].slave == slave ) {
+                speed = &device_speed[i].speed;
+                break;
+            }
+        }
+    }
+
+    TWBR = speed->twbr;
+    TWSR = speed->prescale;
 }
 
 void i2c_release( void )
@@ -375,10 +564,11 @@ I2CStatus i2c_auto_process( void )
         if ( status == I2CACK ) {
             /* ACKだったので送信と(N)ACK受信開始 */
             /* 書き込みポインター初期化 */
-            unit.pos = 0;
+            unit.pos     = 0;
+            unit.segment = 0;
 
             /* 送信 */
-            i2c_master_write( unit.data[unit.pos] );
+            i2c_auto_write_next();
 
             return I2CWorking;
         } else if ( status == I2CNACK ) {
@@ -405,21 +595,18 @@ I2CStatus i2c_auto_process( void )
             /* ポインタ加算 */
             unit.pos++;
 
-            /* 終了確認 */
-            if ( unit.pos == unit.size ) {
-                /* 全部書きこみ終わったので終了 */
-                unit.complete = I2CSuccess;
-                unit.step     = I2CStepNone;
-                if ( auto_callback != NULL ) {
-                    auto_callback();
-                }
-                return I2CSuccess;
-            } else {
-                /* まだ書き込む必要があるので次を書き込む */
-                i2c_master_write( unit.data[unit.pos] );
-
+            /* まだ書き込む必要があれば次を書き込む */
+            if ( i2c_auto_write_next() ) {
                 return I2CWorking;
             }
+
+            /* 全部書きこみ終わったので終了 */
+            unit.complete = I2CSuccess;
+            unit.step     = I2CStepNone;
+            if ( auto_callback != NULL ) {
+                auto_callback();
+            }
+            return I2CSuccess;
         } else if ( status == I2CNACK ) {
             /* スレーブからNACKが帰ってきたので即終了 */
             i2c_master_stop();
@@ -468,10 +655,62 @@ void i2c_auto_master_start( uint8_t slave, I2CRW rw, uint8_t *data, size_t size
     unit.slave    = slave;
     unit.complete = I2CWorking;
 
+    /* 書き込みは1セグメントとして扱う */
+    unit.single.data    = data;
+    unit.single.size    = size;
+    unit.segments       = &unit.single;
+    unit.segment_count  = 1;
+
     /* スタートコンディション発行 */
+    i2c_apply_speed( slave, NULL );
     i2c_master_start();
 }
 
+void i2c_auto_master_start_segments( uint8_t slave, const I2CSegment *segments, uint8_t count )
+{
+    /* 複数セグメントの書き込みを自動実行開始 */
+    size_t total = 0;
+    uint8_t i;
+
+    for ( i = 0; i < count; i++ ) {
+        total += segments[i].size;
+    }
+
+    /* 1バイトもなければ何もしない */
+    if ( total < 1 ) {
+        return;
+    }
+
+    /* 必要な情報を保存 */
+    unit.rw       = I2CW;
+    unit.side     = I2CMaster;
+    unit.slave    = slave;
+    unit.complete = I2CWorking;
+    unit.segments      = segments;
+    unit.segment_count = count;
+
+    /* スタートコンディション発行 */
+    i2c_apply_speed( slave, NULL );
+    i2c_master_start();
+}
+
+static char i2c_auto_write_next( void )
+{
+    /* 現在位置の1バイトを送信 ( 空のセグメントは飛ばす ) 全部送り終わっていれば0 */
+    while ( unit.segment < unit.segment_count && unit.pos >= unit.segments[unit.segment].size ) {
+        unit.segment++;
+        unit.pos = 0;
+    }
+
+    if ( unit.segment >= unit.segment_count ) {
+        return 0;
+    }
+
+    i2c_master_write( unit.segments[unit.segment].data[unit.pos] );
+
+    return 1;
+}
+
 uint8_t i2c_read( void )
 {
     /* i2cデーターレジスターから読み出し */
@@ -491,33 +730,87 @@ I2CStatus i2c_auto_complete( void )
     return unit.complete;
 }
 
-char i2c_write_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode )
+static I2CStatus i2c_wait( I2CProcessMode mode )
 {
-    /* レジスタ書き込み */
-    uint8_t wdata[17];
-    int i;
+    /* 自動処理の完了をタイムアウト付きで待つ */
     I2CStatus status;
+    uint8_t start = ticks;
+    uint16_t spin = 0;
 
-    /* i2cアクセスの制限で16バイト以上かけない */
-    if ( size > 16 ) {
-        return 0;
+    while ( 1 ) {
+        if ( mode == I2CPolling ) {
+            status = i2c_auto_process();
+        } else {
+            status = i2c_auto_complete();
+        }
+
+        if ( status != I2CWorking ) {
+            return status;
+        }
+
+        /* tickが進まない ( 割り込み禁止中 ) 場合は回数で諦める */
+        if ( (uint8_t)( ticks - start ) >= timeout_ticks || ( ticks == start && ++spin >= I2C_SPIN_LIMIT ) ) {
+            i2c_recover_bus();
+            return I2CTimeout;
+        }
     }
+}
+
+static char i2c_wait_queue( void )
+{
+    /* キューが動いていれば終わるまで待つ ( キュー側のタイムアウトが効かなければここで止める ) */
+    uint8_t start = ticks;
+    uint16_t spin = 0;
+    uint8_t sreg;
+
+    while ( i2c_queue_busy() ) {
+        /* 時間切れならここで復旧 */
+        i2c_poll();
 
-    wdata[0] = address;
+        if ( ticks == start && ++spin >= I2C_SPIN_LIMIT ) {
+            sreg = SREG;
+            cli();
 
-    for ( i = 0; i < size; i++ ) {
-        wdata[i + 1] = data[i];
+            while ( i2c_queue_busy() ) {
+                i2c_queue_abort();
+            }
+
+            SREG = sreg;
+
+            return 0;
+        }
     }
 
-    i2c_auto_master_start( slave, I2CW, wdata, size + 1 );
+    return 1;
+}
 
-    if ( mode == I2CPolling ) {
-        while ( ( status = i2c_auto_process() ) == I2CWorking );
-    } else {
-        while ( ( status = i2c_auto_complete() ) == I2CWorking );
+char i2c_write_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode )
+{
+    /* レジスタ書き込み ( アドレスとデータを別々のセグメントでそのまま送る ) */
+    I2CSegment segments[2];
+
+    segments[0].data = &address;
+    segments[0].size = 1;
+    segments[1].data = data;
+    segments[1].size = size;
+
+    return i2c_write_segments( slave, segments, 2, mode );
+}
+
+char i2c_write_segments( uint8_t slave, const I2CSegment *segments, uint8_t count, I2CProcessMode mode )
+{
+    /* セグメントを続けて書き込み */
+    I2CStatus status;
+
+    /* キューが動いていれば終わるまで待つ */
+    if ( !i2c_wait_queue() ) {
+        return 0;
     }
 
-    if ( status == I2CError ) {
+    i2c_auto_master_start_segments( slave, segments, count );
+
+    /* NACK・タイムアウトも失敗 ( NACKはSTOP済み ) */
+    if ( ( status = i2c_wait( mode ) ) != I2CSuccess ) {
         return 0;
     }
     i2c_auto_master_stop();
@@ -530,30 +823,261 @@ char i2c_read_register( uint8_t slave, uint8_t address, uint8_t *data, size_t si
     /* レジスタ読み込み */
     I2CStatus status;
 
-    i2c_auto_master_start( slave, I2CW, &address, 1 );
-
-    if ( mode == I2CPolling ) {
-        while ( ( status = i2c_auto_process() ) == I2CWorking );
-    } else {
-        while ( ( status = i2c_auto_complete() ) == I2CWorking );
+    /* キューが動いていれば終わるまで待つ */
+    if ( !i2c_wait_queue() ) {
+        return 0;
     }
 
-    if ( status == I2CError ) {
+    i2c_auto_master_start( slave, I2CW, &address, 1 );
+
+    if ( ( status = i2c_wait( mode ) ) != I2CSuccess ) {
         return 0;
     }
 
     i2c_auto_master_start( slave, I2CR, data, size );
 
-    if ( mode == I2CPolling ) {
-        while ( ( status = i2c_auto_process() ) == I2CWorking );
-    } else {
-        while ( ( status = i2c_auto_complete() ) == I2CWorking );
+    if ( ( status = i2c_wait( mode ) ) != I2CSuccess ) {
+        return 0;
     }
+    i2c_auto_master_stop();
 
-    if ( status == I2CError ) {
+    return 1;
+}
+
+char i2c_queue_push( I2CTransaction *transaction )
+{
+    /* トランザクションをキューに追加し，止まっていれば開始 */
+    uint8_t sreg;
+
+    sreg = SREG;
+    cli();
+
+    if ( queue.count >= I2C_QUEUE_LENGTH ) {
+        SREG = sreg;
         return 0;
     }
-    i2c_auto_master_stop();
+
+    transaction->status = I2CWorking;
+    queue.items[( queue.head + queue.count ) % I2C_QUEUE_LENGTH] = transaction;
+    queue.count++;
+
+    /* 完了処理中ならそちらで次を開始する */
+    if ( queue.step == I2CQueueStepIdle ) {
+        i2c_queue_start_next();
+    }
+
+    SREG = sreg;
 
     return 1;
 }
+
+char i2c_queue_busy( void )
+{
+    /* キュー処理中か */
+    return ( queue.count != 0 || queue.step != I2CQueueStepIdle );
+}
+
+static void i2c_queue_start_next( void )
+{
+    /* 先頭のトランザクションのスタートコンディション発行 ( 割り込み禁止中に呼ぶ ) */
+    I2CTransaction *transaction = queue.items[queue.head];
+
+    queue.step    = I2CQueueStepStart;
+    queue.elapsed = 0;
+    queue.timeout = 0;
+    i2c_apply_speed( transaction->slave, transaction->speed );
+
+    TWCR = _BV( TWINT ) | _BV( TWSTA ) | _BV( TWEN ) | _BV( TWIE );
+}
+
+static void i2c_queue_pop( I2CStatus status )
+{
+    /* 先頭のトランザクションを完了させてコールバック */
+    I2CTransaction *transaction;
+
+    transaction = queue.items[queue.head];
+    queue.head  = ( queue.head + 1 ) % I2C_QUEUE_LENGTH;
+    queue.count--;
+
+    /* 終わったので時間切れの印も消す */
+    queue.timeout = 0;
+
+    /* コールバック中のpushで勝手に開始しないように */
+    queue.step = I2CQueueStepFinish;
+
+    transaction->status = status;
+
+    if ( transaction->callback != NULL ) {
+        transaction->callback( transaction );
+    }
+}
+
+static void i2c_queue_finish( I2CStatus status )
+{
+    /* 先頭のトランザクションを完了させ，次があればSTOPに続けてSTART */
+    I2CTransaction *transaction;
+
+    i2c_queue_pop( status );
+
+    if ( queue.count ) {
+        /* STOPとSTARTを同時に指定するとSTOPの後にSTARTが出る */
+        transaction = queue.items[queue.head];
+
+        queue.step    = I2CQueueStepStart;
+        queue.elapsed = 0;
+        queue.timeout = 0;
+        i2c_apply_speed( transaction->slave, transaction->speed );
+
+        TWCR = _BV( TWINT ) | _BV( TWSTO ) | _BV( TWSTA ) | _BV( TWEN ) | _BV( TWIE );
+    } else {
+        /* 空になったので割り込みを止める */
+        queue.step = I2CQueueStepIdle;
+
+        TWCR = _BV( TWINT ) | _BV( TWSTO ) | _BV( TWEN );
+    }
+}
+
+static void i2c_queue_abort( void )
+{
+    /* 先頭のトランザクションを時間切れにしてバスを復旧 ( 割り込みの外で呼ぶ ) */
+    uint8_t sreg;
+
+    /* TWI割り込みを止めて，復旧中にpushされても開始しないようにする */
+    sreg = SREG;
+    cli();
+    TWCR          = 0;
+    queue.step    = I2CQueueStepFinish;
+    queue.timeout = 0;
+    SREG = sreg;
+
+    /* ビットバングは割り込み許可のまま ( 100us以上かかる ) */
+    i2c_recover_bus();
+
+    sreg = SREG;
+    cli();
+
+    if ( queue.count ) {
+        i2c_queue_pop( I2CTimeout );
+    }
+
+    if ( queue.count ) {
+        i2c_queue_start_next();
+    } else {
+        queue.step = I2CQueueStepIdle;
+    }
+
+    SREG = sreg;
+}
+
+void i2c_queue_process( void )
+{
+    /* TWI割り込みごとに1ステップ進める */
+    I2CTransaction *transaction;
+    I2CStatus status;
+
+    /* 関係ない割り込みなら止める */
+    if ( queue.count == 0 ) {
+        queue.step = I2CQueueStepIdle;
+        i2c_enable_int( 0 );
+        return;
+    }
+
+    transaction = queue.items[queue.head];
+
+    switch ( queue.step ) {
+    case I2CQueueStepStart:
+    case I2CQueueStepRestart:
+        /* (リピート)スタートコンディション発行完了 */
+        if ( i2c_status_master_started() != I2CSuccess ) {
+            i2c_queue_finish( I2CError );
+        } else if ( queue.step == I2CQueueStepRestart ) {
+            i2c_master_address( transaction->slave, I2CR );
+            queue.step = I2CQueueStepAddressR;
+        } else {
+            i2c_master_address( transaction->slave, I2CW );
+            queue.step = I2CQueueStepAddressW;
+        }
+        break;
+
+    case I2CQueueStepAddressW:
+        /* SLA+W送信完了なのでレジスターアドレス送信 */
+        status = i2c_status_master_address_ack();
+
+        if ( status == I2CACK ) {
+            i2c_master_write( transaction->address );
+            queue.step = I2CQueueStepRegister;
+        } else {
+            i2c_queue_finish( status == I2CNACK ? I2CNACK : I2CError );
+        }
+        break;
+
+    case I2CQueueStepRegister:
+        /* レジスターアドレス送信完了 */
+        status = i2c_status_master_writ_ack();
+
+        if ( status != I2CACK ) {
+            i2c_queue_finish( status == I2CNACK ? I2CNACK : I2CError );
+        } else if ( transaction->rw == I2CR ) {
+            /* 読み込みはリピートスタート */
+            i2c_master_start();
+            queue.step = I2CQueueStepRestart;
+        } else if ( transaction->size == 0 ) {
+            i2c_queue_finish( I2CSuccess );
+        } else {
+            queue.pos = 0;
+            i2c_master_write( transaction->data[0] );
+            queue.step = I2CQueueStepWrite;
+        }
+        break;
+
+    case I2CQueueStepWrite:
+        /* データ送信完了 */
+        status = i2c_status_master_writ_ack();
+
+        if ( status != I2CACK ) {
+            i2c_queue_finish( status == I2CNACK ? I2CNACK : I2CError );
+        } else if ( ++queue.pos == transaction->size ) {
+            i2c_queue_finish( I2CSuccess );
+        } else {
+            i2c_master_write( transaction->data[queue.pos] );
+        }
+        break;
+
+    case I2CQueueStepAddressR:
+        /* SLA+R送信完了なので受信開始 */
+        status = i2c_status_master_address_ack();
+
+        if ( status != I2CACK ) {
+            i2c_queue_finish( status == I2CNACK ? I2CNACK : I2CError );
+        } else if ( transaction->size == 0 ) {
+            i2c_queue_finish( I2CSuccess );
+        } else {
+            queue.pos = 0;
+            i2c_master_read_ack( transaction->size < 2 ? I2CNACK : I2CACK );
+            queue.step = I2CQueueStepRead;
+        }
+        break;
+
+    case I2CQueueStepRead:
+        /* 1バイト受信完了 */
+        if ( i2c_status_master_read() != I2CSuccess ) {
+            i2c_queue_finish( I2CError );
+            break;
+        }
+
+        transaction->data[queue.pos++] = i2c_read();
+
+        if ( queue.pos == transaction->size ) {
+            i2c_queue_finish( I2CSuccess );
+        } else {
+            /* 最後のバイトはNACK */
+            i2c_master_read_ack( queue.pos == transaction->size - 1 ? I2CNACK : I2CACK );
+        }
+        break;
+
+    default:
+        /* ありえないので停止 */
+        i2c_queue_finish( I2CError );
+        break;
+    }
+}
@@ -14,7 +14,13 @@
  *
  * コードサイズが大きすぎる場合は，コールバック処理，プルアップ処理，自動処理をソースコードから消しても問題ありません．
  *
+ * SCL = F_CPU / ( 16 + 2 * TWBR * Prescale )
  * 8MHzの場合，TWBR = 2, Prescale = 1で400KHz TWBR = 32, Prescale = 1で100KHz
+ * i2c_init_masterには目標の周波数[Hz]を渡すと，それを超えない最も速いTWBR/Prescaleを計算します．
+ *
+ * 遅いデバイスが混ざっている場合は，i2c_set_device_frequency()でスレーブアドレスごとに周波数を登録すると，
+ * そのスレーブへのSTART前にTWBR/Prescaleを切り替えます．( 登録できるのはI2C_DEVICE_SPEED_COUNT個まで )
+ * キュー処理ではI2CTransactionのspeedを指定するとさらにそれを優先します．( NULLならデバイスごとの設定 )
  *
  **********
  * 使い方
@@ -65,6 +71,10 @@
  *
  * i2c_auto_process()でI2CSuccess以外が帰ってきた場合は，そのまま終了して放置して良い．
  *
+ * 書き込みはi2c_auto_master_start_segments()で複数のバッファー ( レジスターアドレスとデータなど ) を
+ * コピーせずに1トランザクションで続けて送れる．( セグメントの配列は完了まで保持すること )
+ * i2c_write_registerはこれでアドレスとデータを別々に送るので，サイズの制限はない．
+ *
  * i2c_auto_process()を割り込みで実行し，i2c_auto_complete()を調べることで，ゆったりとしたポーリングすることも可能
  * また，コールバックを登録している場合は，i2c_auto_complete()が変化したタイミングでコールバックされる
  *  I2CError   : どこかのタイミングで何かしらのエラーが発生した
@@ -72,6 +82,32 @@
  *  I2CNACK    : どこかのタイミングでNACKされた
  *  I2CWorking : 処理中
  *
+ *********
+ * キュー処理
+ *********
+ * I2CTransactionにスレーブ，レジスター，バッファー，サイズ，コールバックを設定してi2c_queue_push()すると，
+ * TWI割り込みでレジスター読み書き ( START, SLA+W, REG, ( RESTART, SLA+R, 読み込み ) / 書き込み, STOP ) を実行します．
+ * 最大I2C_QUEUE_LENGTH個まで並べられ，完了したら次のトランザクションを自動で開始します．
+ *
+ * ISR( TWI_vect ) から i2c_queue_process() を呼んでください．
+ * TWIEはキューが動いている間だけ有効になるので，キューが空の間は通常の関数も使えます．
+ * ( i2c_write_register / i2c_read_register はキューが空になるのを待ってから動きます )
+ *
+ * 完了すると transaction->status が I2CSuccess / I2CNACK / I2CError になり，
+ * コールバックが＊割り込み中に＊呼ばれます．コールバックの中からi2c_queue_pushしても構いません．
+ * トランザクションはキューに入っている間ユーザーが保持しておく必要があります．
+ *
+ *********
+ * タイムアウト
+ *********
+ * 周期割り込み ( main.cでは100usごと ) からi2c_tick()を呼ぶと，
+ * 1トランザクションがi2c_set_timeout()で指定したtick数 ( 初期値I2C_DEFAULT_TIMEOUT ) を超えた時点で時間切れの印を付けます．
+ * メインループからi2c_poll()を呼ぶと，時間切れのトランザクションを
+ * i2c_recover_bus()でバスを復旧 ( SCLを9回動かしてSTOPを出し，TWIを再初期化 ) して I2CTimeout で終了させます．
+ * ( 復旧は100us以上かかるので周期割り込みの中ではしない．コールバックもi2c_poll()の中で呼ばれます ) 
+ * i2c_write_register / i2c_read_register も同じ時間で諦めて0を返します．
+ * 割り込み禁止中などでtickが進まない場合は，I2C_SPIN_LIMIT回ポーリングしたところで諦めます．
+ *
  */
 
 #ifndef I2C_H_INCLUDED
@@ -80,8 +116,12 @@
 #include "ide.h"
 #include <stdint.h>
 #include <stdlib.h>
+
+/* I2C_SIMを定義するとi2c_sim.cのPC用シミュレーターに置き換えられる */
+#ifndef I2C_SIM
 #include <avr/io.h>
 #include <util/twi.h>
+#endif
 
 typedef enum I2CPin_tag {
     I2CSCL = 0x01,
@@ -111,6 +151,7 @@ typedef enum I2CStatus_tag {
     I2CSuccess,
     I2CACK,
     I2CNACK,
+    I2CTimeout,
 } I2CStatus;
 
 typedef enum I2CStep_tag {
@@ -129,6 +170,26 @@ typedef enum I2CProcessMode_tag {
     I2CInterrupt,
 } I2CProcessMode;
 
+/* バス速度 ( i2c_calc_speedで作る ) */
+typedef struct I2CSpeed_tag {
+    uint8_t     twbr;
+    I2CPrescale prescale;
+} I2CSpeed;
+
+#define I2C_DEVICE_SPEED_COUNT 4
+
+/* デバイスごとの速度の内部用 */
+typedef struct I2CDeviceSpeed_tag {
+    uint8_t  slave;
+    I2CSpeed speed;
+} I2CDeviceSpeed;
+
+/* 書き込みの1区間 ( 複数の区間を1トランザクションで続けて送る ) */
+typedef struct I2CSegment_tag {
+    const uint8_t *data;
+    size_t        size;
+} I2CSegment;
+
 /* 自動処理の内部用 */
 typedef struct I2CUnit_tag {
     I2CStep   step;
@@ -139,20 +200,71 @@ typedef struct I2CUnit_tag {
     size_t    pos;
     uint8_t   slave;
     volatile I2CStatus complete;
+
+    /* 書き込みはセグメント単位 */
+    const I2CSegment *segments;
+    uint8_t   segment_count;
+    uint8_t   segment;
+    I2CSegment single;
 } I2CUnit;
 
+#define I2C_QUEUE_LENGTH 4
+#define I2C_DEFAULT_TIMEOUT 100     /* tick ( 100usなら10ms ) */
+#define I2C_SPIN_LIMIT 0xFFFF       /* tickが進まないときのポーリング回数 */
+
+/* キュー処理の1トランザクション */
+typedef struct I2CTransaction_tag {
+    uint8_t   slave;
+    uint8_t   address;          /* レジスターアドレス */
+    I2CRW     rw;
+    uint8_t   *data;
+    size_t    size;
+    void      (*callback)( struct I2CTransaction_tag *transaction );
+    void      *user;            /* コールバック用 */
+    const I2CSpeed *speed;      /* NULLならデバイスごとの設定 */
+    volatile I2CStatus status;
+} I2CTransaction;
+
+typedef enum I2CQueueStep_tag {
+    I2CQueueStepIdle,
+    I2CQueueStepStart,
+    I2CQueueStepAddressW,
+    I2CQueueStepRegister,
+    I2CQueueStepRestart,
+    I2CQueueStepAddressR,
+    I2CQueueStepRead,
+    I2CQueueStepWrite,
+    I2CQueueStepFinish,
+} I2CQueueStep;
+
+/* キュー処理の内部用 */
+typedef struct I2CQueue_tag {
+    I2CTransaction *volatile items[I2C_QUEUE_LENGTH];
+    volatile uint8_t head;
+    volatile uint8_t count;
+    volatile I2CQueueStep step;
+    size_t pos;
+    volatile uint8_t elapsed;   /* 現在のトランザクションの経過tick */
+    volatile char timeout;      /* 時間切れ ( i2c_pollで復旧する ) */
+} I2CQueue;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* 初期化・解放 */
-void i2c_init_master( uint8_t baud, I2CPrescale prescale, I2CPin pullup, char int_enable );
+void i2c_init_master( uint32_t frequency, I2CPin pullup, char int_enable );
 void i2c_release( void );
 void i2c_enable( char enable );
 void i2c_enable_int( char enable );
 void i2c_enable_pullup_SDA( char enable );
 void i2c_enable_pullup_SCL( char enable );
 
+/* 速度 */
+char i2c_calc_speed( uint32_t frequency, I2CSpeed *speed );
+void i2c_set_frequency( uint32_t frequency );
+char i2c_set_device_frequency( uint8_t slave, uint32_t frequency );    /* 0で登録解除 */
+
 /* マスター通信関数 */
 void i2c_master_start( void );
 void i2c_master_address( uint8_t slave, I2CRW rw );
@@ -173,10 +285,23 @@ void i2c_auto_set_callback( void (*func)( void ) );		/* autoが何らかのcompl
 I2CStatus i2c_auto_process( void );						/* 読み書き完了後のstop/startは実行せず，ユーザーに任せる */
 I2CStatus i2c_auto_complete( void );					/* どのような状態で処理が完了したかを返す．処理中ならI2CWorking */
 void i2c_auto_master_start( uint8_t slave, I2CRW rw, uint8_t *data, size_t size );
+void i2c_auto_master_start_segments( uint8_t slave, const I2CSegment *segments, uint8_t count );
 void i2c_auto_master_stop( void );
 
 char i2c_write_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode );
 char i2c_read_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode );
+char i2c_write_segments( uint8_t slave, const I2CSegment *segments, uint8_t count, I2CProcessMode mode );
+
+/* タイムアウト・バス復旧 */
+void i2c_tick( void );                                  /* 周期割り込みから呼ぶ */
+void i2c_poll( void );                                  /* メインループから呼ぶ ( 時間切れならバス復旧 ) */
+void i2c_set_timeout( uint8_t ticks );
+void i2c_recover_bus( void );
+
+/* 割り込みキュー処理 */
+char i2c_queue_push( I2CTransaction *transaction );     /* いっぱいなら0 */
+char i2c_queue_busy( void );
+void i2c_queue_process( void );                         /* ISR( TWI_vect )から呼ぶ */
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1112 @@
+#include "i2c_sim.h"
+#include <string.h>
+#include <math.h>
+
+#define I2C_SIM_MPU9150_SLAVE   0x68
+#define I2C_SIM_AK8975_SLAVE    0x0C
+#define I2C_SIM_AK8975_MEASURE  7300000ULL      /* 単発測定時間[ns] */
+#define I2C_SIM_LPS25H_ONE_SHOT 40000000ULL     /* LPS25Hのワンショット変換時間[ns] ( 512回平均で約40ms ) */
+#define I2C_SIM_LPS25H_FIFO     32              /* LPS25HのFIFOの段数 */
+#define I2C_SIM_FIFO_SIZE       1024            /* MPU9150のFIFO */
+
+/* 仮想デバイス */
+typedef struct I2CSimDevice_tag {
+    I2CSimDeviceType type;
+    uint8_t  slave;
+    uint8_t  regs[256];
+    uint64_t period;        /* サンプル周期[ns] 0なら止まっている */
+    uint64_t next;          /* 次のサンプル時刻 */
+    char     one_shot;      /* 次のサンプルで止まる */
+    uint32_t sample;        /* 次のサンプル番号 */
+    char     unread;        /* 最新のサンプルがまだ読まれていない */
+    I2CSimStats stats;
+
+    /* FIFO ( MPU9150 ) 統計はフレーム単位で，欠けたフレームは落ちたサンプル */
+    uint8_t  fifo[I2C_SIM_FIFO_SIZE];
+    uint16_t fifo_head;
+    uint16_t fifo_count;
+    uint8_t  fifo_frame;    /* 1サンプルのバイト数 */
+    uint8_t  fifo_partial;  /* 先頭フレームの取り出し済みバイト数 */
+    char     fifo_damaged;  /* 先頭フレームが溢れて欠けた */
+} I2CSimDevice;
+
+/* 記録波形 */
+typedef struct I2CSimWaveform_tag {
+    const int32_t *values;
+    uint32_t count;
+} I2CSimWaveform;
+
+/* 正弦波のパラメーター */
+typedef struct I2CSimSine_tag {
+    double offset;
+    double amplitude;
+    double frequency;   /* [Hz] */
+} I2CSimSine;
+
+static const I2CSimSine sines[I2C_SIM_CHANNEL_COUNT] = {
+    {       0.0, 2048.0, 1.00 },   /* 加速度 16g: 2048LSB/g */
+    {       0.0, 2048.0, 1.30 },
+    {    2048.0,  512.0, 0.70 },
+    {   -3500.0,   50.0, 0.01 },   /* MPU9150温度 ( 約25度 ) */
+    {       0.0, 1000.0, 2.00 },   /* ジャイロ */
+    {       0.0,  800.0, 2.60 },
+    {       0.0,  600.0, 3.10 },
+    {     100.0,  200.0, 0.20 },   /* 地磁気 */
+    {    -150.0,  200.0, 0.25 },
+    {     300.0,  200.0, 0.30 },
+    { 4150272.0,  400.0, 0.05 },   /* 気圧 1013.25hPa * 4096 */
+    {  -8400.0,   100.0, 0.01 },   /* LPS25H温度 ( 約25度 ) */
+};
+
+static I2CSimDevice devices[I2C_SIM_DEVICE_COUNT];
+static I2CSimWaveform waveforms[I2C_SIM_CHANNEL_COUNT];
+static uint8_t lps25h_slave = 0x5D;
+
+static uint64_t now;
+static uint64_t access_time;    /* レジスターアクセスの時刻 ( 補助I2Cならそのサンプルの時刻 ) */
+static uint64_t bus_busy;
+static uint8_t  timeout;
+
+static I2CSpeed default_speed;
+static I2CDeviceSpeed device_speed[I2C_DEVICE_SPEED_COUNT];
+static uint8_t device_speed_count;
+
+static I2CSimIntHandler int_handler;
+
+static I2CQueue queue;
+static uint64_t queue_done;     /* 先頭のトランザクションが終わる時刻 */
+
+static void i2c_sim_reset_device( I2CSimDevice *dev );
+static void i2c_sim_update( I2CSimDevice *dev, uint64_t t );
+static void i2c_sim_update_all( void );
+static void i2c_sim_start( I2CSimDevice *dev, uint64_t period, char one_shot );
+static void i2c_sim_produce( I2CSimDevice *dev, uint64_t t );
+static void i2c_sim_mark_read( I2CSimDevice *dev );
+static char i2c_sim_fifo_active( I2CSimDevice *dev );
+static char i2c_sim_lps25h_int( I2CSimDevice *dev );
+static void i2c_sim_fifo_push( I2CSimDevice *dev, uint8_t value );
+static void i2c_sim_fifo_consume( I2CSimDevice *dev, char discard );
+static void i2c_sim_fifo_reset( I2CSimDevice *dev );
+static int32_t i2c_sim_value( I2CSimChannel channel, uint32_t sample, uint64_t t );
+static I2CSimDevice *i2c_sim_find( uint8_t slave );
+static void i2c_sim_aux( I2CSimDevice *dev, uint32_t sample, uint64_t t );
+static uint8_t i2c_sim_mpu_frame( I2CSimDevice *dev );
+static uint8_t i2c_sim_read_byte( I2CSimDevice *dev, uint8_t *pointer );
+static void i2c_sim_write_byte( I2CSimDevice *dev, uint8_t *pointer, uint8_t value );
+static uint64_t i2c_sim_duration( uint8_t slave, const I2CSpeed *speed, size_t bytes, uint8_t starts );
+static I2CStatus i2c_sim_read( uint8_t slave, uint8_t address, uint8_t *data, size_t size );
+static I2CStatus i2c_sim_write( uint8_t slave, const I2CSegment *segments, uint8_t count );
+static uint64_t i2c_sim_transaction_duration( const I2CTransaction *transaction );
+
+void i2c_sim_reset( void )
+{
+    /* 全デバイスをリセット状態に戻して時間を0にする */
+    int i;
+
+    now      = 0;
+    access_time = 0;
+    bus_busy = 0;
+    timeout  = I2C_DEFAULT_TIMEOUT;
+
+    memset( &queue, 0, sizeof( queue ) );
+    queue_done = 0;
+
+    device_speed_count = 0;
+    i2c_calc_speed( 100000UL, &default_speed );
+
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        devices[i].type = i;
+        memset( &devices[i].stats, 0, sizeof( devices[i].stats ) );
+        i2c_sim_reset_device( &devices[i] );
+    }
+}
+
+void i2c_sim_set_lps25h_address( uint8_t slave )
+{
+    /* LPS25Hのスレーブアドレス */
+    lps25h_slave = slave;
+    devices[I2CSimLPS25H].slave = slave;
+}
+
+void i2c_sim_set_waveform( I2CSimChannel channel, const int32_t *values, uint32_t count )
+{
+    /* 記録波形を設定 */
+    if ( channel >= I2C_SIM_CHANNEL_COUNT ) {
+        return;
+    }
+
+    waveforms[channel].values = ( count ) ? values : NULL;
+    waveforms[channel].count  = count;
+}
+
+uint64_t i2c_sim_now( void )
+{
+    /* 現在の仮想時間 */
+    return now;
+}
+
+void i2c_sim_advance( uint64_t ns )
+{
+    /* 仮想時間を進める ( その間に終わるキューのトランザクションを実行してコールバック ) */
+    uint64_t end = now + ns;
+    I2CTransaction *transaction;
+    uint64_t duration;
+
+    while ( queue.count && queue_done <= end ) {
+        now = queue_done;
+        transaction = queue.items[queue.head];
+
+        duration = i2c_sim_transaction_duration( transaction );
+        bus_busy += duration;
+
+        if ( transaction->rw == I2CR ) {
+            transaction->status = i2c_sim_read( transaction->slave, transaction->address, transaction->data, transaction->size );
+        } else {
+            I2CSegment segments[2] = { { &transaction->address, 1 }, { transaction->data, transaction->size } };
+
+            transaction->status = i2c_sim_write( transaction->slave, segments, 2 );
+        }
+
+        /* 先に取り出してからコールバック ( 中でpushしてもよい ) */
+        queue.head = ( queue.head + 1 ) % I2C_QUEUE_LENGTH;
+        queue.count--;
+
+        if ( transaction->callback ) {
+            transaction->callback( transaction );
+        }
+
+        if ( queue.count ) {
+            queue_done = now + i2c_sim_transaction_duration( queue.items[queue.head] );
+        }
+    }
+
+    now = end;
+    i2c_sim_update_all();
+}
+
+void i2c_sim_drain( void )
+{
+    /* キューが空になるまで進める */
+    while ( queue.count ) {
+        i2c_sim_advance( queue_done - now );
+    }
+}
+
+uint64_t i2c_sim_bus_busy( void )
+{
+    /* バスが使われていた合計時間 */
+    return bus_busy;
+}
+
+void i2c_sim_set_int_handler( I2CSimIntHandler handler )
+{
+    /* 割り込みピンのハンドラー */
+    int_handler = handler;
+}
+
+char i2c_sim_int_level( I2CSimDeviceType type )
+{
+    /* 割り込みピンの今のレベル */
+    if ( type == I2CSimLPS25H ) {
+        return i2c_sim_lps25h_int( &devices[I2CSimLPS25H] );
+    }
+
+    return 0;
+}
+
+const I2CSimStats *i2c_sim_stats( I2CSimDeviceType type )
+{
+    /* デバイスごとの統計 */
+    if ( type >= I2C_SIM_DEVICE_COUNT ) {
+        return NULL;
+    }
+
+    return &devices[type].stats;
+}
+
+void i2c_sim_report( FILE *out )
+{
+    /* 統計を表示 */
+    static const char *names[I2C_SIM_DEVICE_COUNT] = { "mpu9150", "ak8975", "lps25h" };
+    const I2CSimStats *stats;
+    int i;
+
+    fprintf( out, "%-8s %10s %10s %10s %12s\n", "device", "produced", "read", "dropped", "transactions" );
+
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        stats = &devices[i].stats;
+
+        fprintf( out, "%-8s %10u %10u %10u %12u\n", names[i],
+                 stats->produced, stats->read, stats->dropped, stats->transactions );
+    }
+
+    if ( now ) {
+        fprintf( out, "bus busy %.1f%%\n", 100.0 * bus_busy / now );
+    }
+}
+
+static void i2c_sim_reset_device( I2CSimDevice *dev )
+{
+    /* パワーオン状態 */
+    memset( dev->regs, 0, sizeof( dev->regs ) );
+    dev->period   = 0;
+    dev->next     = 0;
+    dev->one_shot = 0;
+    dev->sample   = 0;
+    dev->unread   = 0;
+
+    dev->fifo_head    = 0;
+    dev->fifo_count   = 0;
+    dev->fifo_frame   = 0;
+    dev->fifo_partial = 0;
+    dev->fifo_damaged = 0;
+
+    switch ( dev->type ) {
+    case I2CSimMPU9150:
+        dev->slave = I2C_SIM_MPU9150_SLAVE;
+        dev->regs[0x6B] = 0x40;     /* スリープ */
+        dev->regs[0x75] = 0x68;     /* WHO_AM_I */
+        break;
+
+    case I2CSimAK8975:
+        dev->slave = I2C_SIM_AK8975_SLAVE;
+        dev->regs[0x00] = 0x48;     /* WIA */
+        dev->regs[0x01] = 0x9A;     /* INFO */
+        dev->regs[0x10] = 0xA6;     /* ASAX-Z */
+        dev->regs[0x11] = 0xA8;
+        dev->regs[0x12] = 0x9C;
+        break;
+
+    case I2CSimLPS25H:
+        dev->slave = lps25h_slave;
+        dev->regs[0x0F] = 0xBD;     /* WHO_AM_I */
+        dev->regs[0x10] = 0x0F;     /* RES_CONF */
+        dev->fifo_frame = 5;        /* 気圧3バイト + 温度2バイト */
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void i2c_sim_start( I2CSimDevice *dev, uint64_t period, char one_shot )
+{
+    /* サンプル周期を変更 ( 0なら停止 ) */
+    i2c_sim_update( dev, access_time );
+
+    dev->period   = period;
+    dev->next     = access_time + period;
+    dev->one_shot = one_shot;
+}
+
+static void i2c_sim_update( I2CSimDevice *dev, uint64_t t )
+{
+    /* tまでに出ているはずのサンプルを作る */
+    while ( dev->period && dev->next <= t ) {
+        i2c_sim_produce( dev, dev->next );
+
+        if ( dev->one_shot ) {
+            dev->period   = 0;
+            dev->one_shot = 0;
+        } else {
+            dev->next += dev->period;
+        }
+    }
+}
+
+static void i2c_sim_update_all( void )
+{
+    /* 全デバイス更新 */
+    int i;
+
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        i2c_sim_update( &devices[i], now );
+    }
+}
+
+static void i2c_sim_put_be16( uint8_t *regs, int16_t value )
+{
+    regs[0] = (uint16_t)value >> 8;
+    regs[1] = value;
+}
+
+static void i2c_sim_put_le16( uint8_t *regs, int16_t value )
+{
+    regs[0] = value;
+    regs[1] = (uint16_t)value >> 8;
+}
+
+static void i2c_sim_produce( I2CSimDevice *dev, uint64_t t )
+{
+    /* 新しいサンプルをレジスターに入れる */
+    uint32_t n = dev->sample;
+    int32_t pressure;
+    char level = 0;
+    int i;
+
+    /* 読まれる前に上書き ( FIFOならFIFOから取り出したときに数える ) */
+    if ( i2c_sim_fifo_active( dev ) ) {
+        dev->unread = 0;
+    } else {
+        if ( dev->unread ) {
+            dev->stats.dropped++;
+        }
+
+        dev->unread = 1;
+    }
+
+    dev->sample++;
+    dev->stats.produced++;
+
+    switch ( dev->type ) {
+    case I2CSimMPU9150:
+        /* 0x3B-0x48 ビッグエンディアン ( 加速度, 温度, ジャイロ ) */
+        for ( i = 0; i < 7; i++ ) {
+            i2c_sim_put_be16( &dev->regs[0x3B + i * 2], i2c_sim_value( I2CSimAccX + i, n, t ) );
+        }
+
+        /* DATA_RDY_INT ( INTピンはサンプルごとにパルス ) */
+        dev->regs[0x3A] |= 0x01;
+
+        if ( ( dev->regs[0x38] & 0x01 ) && int_handler ) {
+            int_handler( dev->type, t );
+        }
+
+        /* 補助I2Cマスター */
+        i2c_sim_aux( dev, n, t );
+
+        /* FIFOへ ( ACCEL, TEMP, XG, YG, ZGの順 ) */
+        if ( i2c_sim_fifo_active( dev ) ) {
+            static const uint8_t bits[7] = { 0x08, 0x08, 0x08, 0x80, 0x40, 0x20, 0x10 };
+
+            for ( i = 0; i < 7; i++ ) {
+                if ( dev->regs[0x23] & bits[i] ) {
+                    i2c_sim_fifo_push( dev, dev->regs[0x3B + i * 2] );
+                    i2c_sim_fifo_push( dev, dev->regs[0x3C + i * 2] );
+                }
+            }
+
+            /* SLV0のEXT_SENS_DATA */
+            if ( dev->regs[0x23] & 0x01 ) {
+                for ( i = 0; i < ( dev->regs[0x27] & 0x0F ); i++ ) {
+                    i2c_sim_fifo_push( dev, dev->regs[0x49 + i] );
+                }
+            }
+        }
+        break;
+
+    case I2CSimAK8975:
+        /* 0x03-0x08 リトルエンディアン */
+        for ( i = 0; i < 3; i++ ) {
+            i2c_sim_put_le16( &dev->regs[0x03 + i * 2], i2c_sim_value( I2CSimMagX + i, n, t ) );
+        }
+
+        dev->regs[0x02] = 0x01;     /* ST1 DRDY */
+        dev->regs[0x09] = 0x00;     /* ST2 */
+        dev->regs[0x0A] = 0x00;     /* 測定後はパワーダウン */
+        break;
+
+    case I2CSimLPS25H:
+        level = i2c_sim_lps25h_int( dev );
+
+        /* 読まれていないデータがあればオーバーラン */
+        if ( dev->regs[0x27] & 0x02 ) {
+            dev->regs[0x27] |= 0x20;
+        }
+
+        if ( dev->regs[0x27] & 0x01 ) {
+            dev->regs[0x27] |= 0x10;
+        }
+
+        dev->regs[0x27] |= 0x03;
+
+        /* 0x28-0x2A 気圧24bit, 0x2B-0x2C 温度 リトルエンディアン */
+        pressure = i2c_sim_value( I2CSimPressure, n, t );
+        dev->regs[0x28] = pressure;
+        dev->regs[0x29] = pressure >> 8;
+        dev->regs[0x2A] = pressure >> 16;
+        i2c_sim_put_le16( &dev->regs[0x2B], i2c_sim_value( I2CSimPressureTemp, n, t ) );
+
+        /* FIFOへ ( 32サンプル ) */
+        if ( i2c_sim_fifo_active( dev ) ) {
+            if ( dev->fifo_count >= I2C_SIM_LPS25H_FIFO * 5 ) {
+                if ( ( dev->regs[0x2E] & 0xE0 ) == 0x20 ) {
+                    /* FIFOモードはいっぱいになったら止まる */
+                    dev->stats.dropped++;
+                    break;
+                }
+
+                /* ストリームモードは一番古いサンプルを捨てる */
+                for ( i = 0; i < 5; i++ ) {
+                    i2c_sim_fifo_consume( dev, 1 );
+                }
+            }
+
+            for ( i = 0; i < 5; i++ ) {
+                i2c_sim_fifo_push( dev, dev->regs[0x28 + i] );
+            }
+        }
+
+        /* INT1の立ち上がり */
+        if ( !level && i2c_sim_lps25h_int( dev ) && int_handler ) {
+            int_handler( dev->type, t );
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void i2c_sim_mark_read( I2CSimDevice *dev )
+{
+    /* 最新のサンプルが読まれた */
+    if ( dev->unread ) {
+        dev->unread = 0;
+        dev->stats.read++;
+    }
+}
+
+static char i2c_sim_fifo_active( I2CSimDevice *dev )
+{
+    /* FIFOにサンプルが入るか */
+    switch ( dev->type ) {
+    case I2CSimMPU9150:
+        return ( ( dev->regs[0x6A] & 0x40 ) && dev->fifo_frame );
+
+    case I2CSimLPS25H:
+        /* CTRL_REG2のFIFO_ENとFIFO_CTRLがバイパスモード以外 */
+        return ( ( dev->regs[0x21] & 0x40 ) && ( dev->regs[0x2E] & 0xE0 ) );
+
+    default:
+        return 0;
+    }
+}
+
+static char i2c_sim_lps25h_int( I2CSimDevice *dev )
+{
+    /* LPS25HのINT1 ( CTRL_REG4で選んだ信号のOR ) */
+    uint8_t sources = dev->regs[0x23];
+    uint16_t count  = dev->fifo_count / 5;
+
+    if ( ( sources & 0x01 ) && ( dev->regs[0x27] & 0x02 ) ) {
+        return 1;
+    }
+
+    if ( !i2c_sim_fifo_active( dev ) ) {
+        return 0;
+    }
+
+    return ( ( sources & 0x02 ) && count >= I2C_SIM_LPS25H_FIFO )
+        || ( ( sources & 0x04 ) && count && count >= ( dev->regs[0x2E] & 0x1F ) )
+        || ( ( sources & 0x08 ) && count == 0 );
+}
+
+static void i2c_sim_fifo_push( I2CSimDevice *dev, uint8_t value )
+{
+    /* FIFOに1バイト入れる ( いっぱいなら一番古いバイトを捨ててFIFO_OFLOW_INT ) */
+    if ( dev->fifo_count >= I2C_SIM_FIFO_SIZE ) {
+        i2c_sim_fifo_consume( dev, 1 );
+        dev->regs[0x3A] |= 0x10;
+    }
+
+    dev->fifo[( dev->fifo_head + dev->fifo_count ) % I2C_SIM_FIFO_SIZE] = value;
+    dev->fifo_count++;
+}
+
+static void i2c_sim_fifo_consume( I2CSimDevice *dev, char discard )
+{
+    /* FIFOの先頭1バイトを取り出す ( 捨てる ) フレームが終わったら統計を数える */
+    dev->fifo_head = ( dev->fifo_head + 1 ) % I2C_SIM_FIFO_SIZE;
+    dev->fifo_count--;
+
+    if ( discard ) {
+        dev->fifo_damaged = 1;
+    }
+
+    if ( ++dev->fifo_partial >= dev->fifo_frame ) {
+        if ( dev->fifo_damaged ) {
+            dev->stats.dropped++;
+        } else {
+            dev->stats.read++;
+        }
+
+        dev->fifo_partial = 0;
+        dev->fifo_damaged = 0;
+    }
+}
+
+static void i2c_sim_fifo_reset( I2CSimDevice *dev )
+{
+    /* FIFOを空にする ( 中のサンプルは落ちたサンプル ) */
+    while ( dev->fifo_count ) {
+        i2c_sim_fifo_consume( dev, 1 );
+    }
+
+    dev->fifo_partial = 0;
+    dev->fifo_damaged = 0;
+}
+
+static int32_t i2c_sim_value( I2CSimChannel channel, uint32_t sample, uint64_t t )
+{
+    /* チャンネルの値 ( 記録波形があればサンプル番号順，なければ正弦波 ) */
+    const I2CSimWaveform *wave = &waveforms[channel];
+    const I2CSimSine *sine = &sines[channel];
+
+    if ( wave->values ) {
+        return wave->values[sample % wave->count];
+    }
+
+    return lround( sine->offset + sine->amplitude * sin( 2.0 * M_PI * sine->frequency * ( t / 1e9 ) ) );
+}
+
+static uint8_t i2c_sim_mpu_frame( I2CSimDevice *dev )
+{
+    /* MPU9150のFIFO_ENから1サンプルのバイト数 */
+    uint8_t value = dev->regs[0x23];
+
+    return ( ( value & 0x08 ) ? 6 : 0 ) + ( ( value & 0x80 ) ? 2 : 0 )
+         + ( ( value & 0x40 ) ? 2 : 0 ) + ( ( value & 0x20 ) ? 2 : 0 ) + ( ( value & 0x10 ) ? 2 : 0 )
+         + ( ( value & 0x01 ) ? ( dev->regs[0x27] & 0x0F ) : 0 );
+}
+
+static void i2c_sim_aux( I2CSimDevice *dev, uint32_t sample, uint64_t t )
+{
+    /* MPU9150の補助I2Cマスター: SLV0で読んでEXT_SENS_DATAへ，SLV1で書く ( バイパスとは関係なく見える ) */
+    I2CSimDevice *slave;
+    uint64_t saved = access_time;
+    uint8_t pointer;
+    uint8_t i;
+    int j;
+
+    if ( !( dev->regs[0x6A] & 0x20 ) ) {
+        return;
+    }
+
+    access_time = t;
+
+    for ( j = 0; j < I2C_SIM_DEVICE_COUNT; j++ ) {
+        slave = &devices[j];
+
+        if ( slave == dev ) {
+            continue;
+        }
+
+        /* SLV0 読み込み */
+        if ( ( dev->regs[0x27] & 0x80 ) && dev->regs[0x25] == ( 0x80 | slave->slave ) ) {
+            i2c_sim_update( slave, t );
+            pointer = dev->regs[0x26];
+
+            for ( i = 0; i < ( dev->regs[0x27] & 0x0F ); i++ ) {
+                dev->regs[0x49 + i] = i2c_sim_read_byte( slave, &pointer );
+            }
+        }
+
+        /* SLV1 書き込み ( I2C_MST_DELAY_CTRLが立っていれば1 + I2C_MST_DLYサンプルごと ) */
+        if ( ( dev->regs[0x2A] & 0x80 ) && dev->regs[0x28] == slave->slave
+             && ( !( dev->regs[0x67] & 0x02 ) || sample % ( 1 + ( dev->regs[0x34] & 0x1F ) ) == 0 ) ) {
+            i2c_sim_update( slave, t );
+            pointer = dev->regs[0x29];
+
+            i2c_sim_write_byte( slave, &pointer, dev->regs[0x64] );
+        }
+    }
+
+    access_time = saved;
+}
+
+static I2CSimDevice *i2c_sim_find( uint8_t slave )
+{
+    /* スレーブアドレスからデバイスを探す ( いなければNACK ) */
+    int i;
+
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        if ( devices[i].slave != slave ) {
+            continue;
+        }
+
+        /* AK8975はMPU9150のバイパスが有効なときだけ見える */
+        if ( devices[i].type == I2CSimAK8975 && !( devices[I2CSimMPU9150].regs[0x37] & 0x02 ) ) {
+            return NULL;
+        }
+
+        return &devices[i];
+    }
+
+    return NULL;
+}
+
+static uint8_t i2c_sim_read_byte( I2CSimDevice *dev, uint8_t *pointer )
+{
+    /* レジスターを1バイト読んでポインターを進める */
+    uint8_t reg = *pointer;
+    uint8_t value;
+    uint16_t count;
+
+    switch ( dev->type ) {
+    case I2CSimMPU9150:
+        value = dev->regs[reg];
+
+        if ( reg == 0x3A ) {
+            /* INT_STATUSは読むとクリア */
+            dev->regs[0x3A] = 0;
+        } else if ( 0x3B <= reg && reg <= 0x48 ) {
+            i2c_sim_mark_read( dev );
+        } else if ( reg == 0x72 ) {
+            value = dev->fifo_count >> 8;
+        } else if ( reg == 0x73 ) {
+            value = dev->fifo_count;
+        } else if ( reg == 0x74 ) {
+            /* FIFO_R_Wはポインターが進まない */
+            if ( dev->fifo_count ) {
+                value = dev->fifo[dev->fifo_head];
+                i2c_sim_fifo_consume( dev, 0 );
+            } else {
+                value = 0xFF;
+            }
+
+            break;
+        }
+
+        *pointer = reg + 1;
+        break;
+
+    case I2CSimAK8975:
+        /* ヒューズROMはヒューズROMアクセスモードのときだけ */
+        if ( 0x10 <= reg && reg <= 0x12 && dev->regs[0x0A] != 0x0F ) {
+            value = 0;
+        } else {
+            value = dev->regs[reg];
+        }
+
+        /* 測定値かST2を読むとDRDYクリア */
+        if ( 0x03 <= reg && reg <= 0x09 ) {
+            dev->regs[0x02] = 0;
+            i2c_sim_mark_read( dev );
+        }
+
+        *pointer = reg + 1;
+        break;
+
+    case I2CSimLPS25H:
+        /* MSBが立っているときだけ自動インクリメント */
+        value = dev->regs[reg & 0x7F];
+
+        if ( ( reg & 0x7F ) == 0x2F ) {
+            /* FIFO_STATUS: WTM_FIFO, FULL_FIFO, EMPTY_FIFO, DIFF_POINT */
+            count = dev->fifo_count / 5;
+            value = count & 0x1F;
+
+            if ( count && count >= ( dev->regs[0x2E] & 0x1F ) ) {
+                value |= 0x80;
+            }
+
+            if ( count >= I2C_SIM_LPS25H_FIFO ) {
+                value |= 0x40;
+            }
+
+            if ( count == 0 ) {
+                value |= 0x20;
+            }
+        } else if ( 0x28 <= ( reg & 0x7F ) && ( reg & 0x7F ) <= 0x2C && i2c_sim_fifo_active( dev ) ) {
+            /* FIFOが有効なら出力レジスターは一番古いサンプル，TEMP_OUT_Hを読むと次へ，0x2Cの次は0x28 */
+            if ( dev->fifo_count ) {
+                value = dev->fifo[( dev->fifo_head + ( reg & 0x7F ) - 0x28 ) % I2C_SIM_FIFO_SIZE];
+
+                if ( ( reg & 0x7F ) == 0x2C ) {
+                    for ( count = 0; count < 5; count++ ) {
+                        i2c_sim_fifo_consume( dev, 0 );
+                    }
+                }
+            }
+
+            if ( ( reg & 0x7F ) == 0x2C ) {
+                dev->regs[0x27] &= ~0x33;
+
+                if ( reg & 0x80 ) {
+                    *pointer = 0x80 | 0x28;
+                }
+
+                break;
+            }
+        } else if ( ( reg & 0x7F ) == 0x2A ) {
+            /* PRESS_OUT_Hで気圧の準備完了とオーバーランをクリア */
+            dev->regs[0x27] &= ~0x22;
+            i2c_sim_mark_read( dev );
+        } else if ( ( reg & 0x7F ) == 0x2C ) {
+            /* TEMP_OUT_Hで温度 */
+            dev->regs[0x27] &= ~0x11;
+        }
+
+        if ( reg & 0x80 ) {
+            *pointer = 0x80 | ( ( reg + 1 ) & 0x7F );
+        }
+        break;
+
+    default:
+        value = 0xFF;
+        break;
+    }
+
+    return value;
+}
+
+static void i2c_sim_write_byte( I2CSimDevice *dev, uint8_t *pointer, uint8_t value )
+{
+    /* レジスターに1バイト書いてポインターを進める */
+    uint8_t reg = *pointer;
+    uint8_t div;
+    uint32_t rate;
+    static const uint8_t lps25h_rates[8] = { 0, 1, 7, 12, 25, 0, 0, 0 };
+
+    switch ( dev->type ) {
+    case I2CSimMPU9150:
+        if ( reg == 0x6B && ( value & 0x80 ) ) {
+            /* デバイスリセット */
+            i2c_sim_reset_device( dev );
+            break;
+        }
+
+        dev->regs[reg] = value;
+
+        if ( reg == 0x6A ) {
+            /* FIFO_RESETはFIFO_ENが0のときだけ ( 自動で0に戻る ) */
+            if ( ( value & 0x04 ) && !( value & 0x40 ) ) {
+                i2c_sim_fifo_reset( dev );
+            }
+
+            dev->regs[0x6A] &= ~0x04;
+        } else if ( reg == 0x23 || reg == 0x27 ) {
+            /* 1サンプルのフレームサイズ */
+            dev->fifo_frame = i2c_sim_mpu_frame( dev );
+        }
+
+        if ( reg == 0x6B || reg == 0x19 || reg == 0x1A ) {
+            /* Sample Rate = Gyroscope Output Rate / ( 1 + SMPLRT_DIV ) */
+            div  = dev->regs[0x1A] & 0x07;
+            rate = ( div == 0 || div == 7 ) ? 8000 : 1000;
+
+            if ( dev->regs[0x6B] & 0x40 ) {
+                i2c_sim_start( dev, 0, 0 );
+            } else {
+                i2c_sim_start( dev, 1000000000ULL * ( 1 + dev->regs[0x19] ) / rate, 0 );
+            }
+        }
+
+        *pointer = reg + 1;
+        break;
+
+    case I2CSimAK8975:
+        if ( reg == 0x0A ) {
+            dev->regs[0x0A] = value & 0x0F;
+
+            if ( ( value & 0x0F ) == 0x01 ) {
+                /* 単発測定 */
+                dev->regs[0x02] = 0;
+                i2c_sim_start( dev, I2C_SIM_AK8975_MEASURE, 1 );
+            } else {
+                i2c_sim_start( dev, 0, 0 );
+            }
+        } else if ( reg == 0x0C ) {
+            dev->regs[reg] = value;
+        }
+
+        *pointer = reg + 1;
+        break;
+
+    case I2CSimLPS25H:
+        dev->regs[reg & 0x7F] = value;
+
+        if ( ( reg & 0x7F ) == 0x20 ) {
+            /* CTRL_REG1 PDとODR ( 12.5Hzは80ms周期 ) */
+            rate = lps25h_rates[( value >> 4 ) & 0x07];
+
+            if ( !( value & 0x80 ) || rate == 0 ) {
+                i2c_sim_start( dev, 0, 0 );
+            } else if ( rate == 12 ) {
+                i2c_sim_start( dev, 80000000ULL, 0 );
+            } else {
+                i2c_sim_start( dev, 1000000000ULL / rate, 0 );
+            }
+        } else if ( ( reg & 0x7F ) == 0x2E && !( value & 0xE0 ) ) {
+            /* バイパスモードにするとFIFOは空になる */
+            i2c_sim_fifo_reset( dev );
+        } else if ( ( reg & 0x7F ) == 0x21 && ( value & 0x01 ) ) {
+            /* ワンショット ( ODRが0で動作中のときだけ ) */
+            dev->regs[0x21] &= ~0x01;
+
+            if ( ( dev->regs[0x20] & 0xF0 ) == 0x80 ) {
+                i2c_sim_start( dev, I2C_SIM_LPS25H_ONE_SHOT, 1 );
+            }
+        }
+
+        if ( reg & 0x80 ) {
+            *pointer = 0x80 | ( ( reg + 1 ) & 0x7F );
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static uint64_t i2c_sim_duration( uint8_t slave, const I2CSpeed *speed, size_t bytes, uint8_t starts )
+{
+    /* バスの通信時間 ( 1バイト9ビット + START/STOP ) */
+    uint8_t i;
+    uint32_t scl;
+
+    if ( speed == NULL ) {
+        speed = &default_speed;
+
+        for ( i = 0; i < device_speed_count; i++ ) {
+            if ( device_speed[i].slave == slave ) {
+                speed = &device_speed[i].speed;
+                break;
+            }
+        }
+    }
+
+    /* SCL = F_CPU / ( 16 + 2 * TWBR * Prescale ) */
+    scl = F_CPU / ( 16 + 2UL * speed->twbr * ( 1UL << ( 2 * speed->prescale ) ) );
+
+    return ( bytes * 9 + starts + 1 ) * 1000000000ULL / scl;
+}
+
+static uint64_t i2c_sim_transaction_duration( const I2CTransaction *transaction )
+{
+    /* キューのトランザクションの通信時間 */
+    if ( transaction->rw == I2CR ) {
+        return i2c_sim_duration( transaction->slave, transaction->speed, 3 + transaction->size, 2 );
+    }
+
+    return i2c_sim_duration( transaction->slave, transaction->speed, 2 + transaction->size, 1 );
+}
+
+static I2CStatus i2c_sim_read( uint8_t slave, uint8_t address, uint8_t *data, size_t size )
+{
+    /* レジスター読み込み */
+    I2CSimDevice *dev = i2c_sim_find( slave );
+    size_t i;
+
+    if ( dev == NULL ) {
+        return I2CNACK;
+    }
+
+    i2c_sim_update_all();
+    access_time = now;
+    dev->stats.transactions++;
+
+    for ( i = 0; i < size; i++ ) {
+        data[i] = i2c_sim_read_byte( dev, &address );
+    }
+
+    return I2CSuccess;
+}
+
+static I2CStatus i2c_sim_write( uint8_t slave, const I2CSegment *segments, uint8_t count )
+{
+    /* レジスター書き込み ( 最初のバイトがレジスターアドレス ) */
+    I2CSimDevice *dev = i2c_sim_find( slave );
+    char first = 1;
+    uint8_t address = 0;
+    uint8_t i;
+    size_t j;
+
+    if ( dev == NULL ) {
+        return I2CNACK;
+    }
+
+    i2c_sim_update_all();
+    access_time = now;
+    dev->stats.transactions++;
+
+    for ( i = 0; i < count; i++ ) {
+        for ( j = 0; j < segments[i].size; j++ ) {
+            if ( first ) {
+                address = segments[i].data[j];
+                first = 0;
+            } else {
+                i2c_sim_write_byte( dev, &address, segments[i].data[j] );
+            }
+        }
+    }
+
+    return I2CSuccess;
+}
+
+/*
+ * i2c.hの関数
+ * 低レベルのマスター通信関数と自動処理はシミュレートしません．
+ */
+
+void i2c_init_master( uint32_t frequency, I2CPin pullup, char int_enable )
+{
+    /* バス速度だけ覚える */
+    i2c_calc_speed( frequency, &default_speed );
+}
+
+char i2c_calc_speed( uint32_t frequency, I2CSpeed *speed )
+{
+    /* i2c.cと同じ計算 */
+    uint32_t div;
+    uint32_t twbr;
+    uint8_t prescale;
+
+    if ( frequency == 0 ) {
+        speed->twbr     = 255;
+        speed->prescale = I2CPrescale64;
+        return 0;
+    }
+
+    div = ( F_CPU + frequency - 1 ) / frequency;
+
+    if ( div <= 16 ) {
+        speed->twbr     = 0;
+        speed->prescale = I2CPrescale1;
+        return 1;
+    }
+
+    div -= 16;
+
+    for ( prescale = 0; prescale < 4; prescale++ ) {
+        twbr = ( div + ( 2UL << ( 2 * prescale ) ) - 1 ) >> ( 1 + 2 * prescale );
+
+        if ( twbr <= 255 ) {
+            speed->twbr     = twbr;
+            speed->prescale = prescale;
+            return 1;
+        }
+    }
+
+    speed->twbr     = 255;
+    speed->prescale = I2CPrescale64;
+
+    return 0;
+}
+
+void i2c_set_frequency( uint32_t frequency )
+{
+    /* 標準のバス速度 */
+    i2c_calc_speed( frequency, &default_speed );
+}
+
+char i2c_set_device_frequency( uint8_t slave, uint32_t frequency )
+{
+    /* スレーブごとのバス速度 */
+    uint8_t i;
+
+    for ( i = 0; i < device_speed_count; i++ ) {
+        if ( device_speed[i].slave == slave ) {
+            break;
+        }
+    }
+
+    if ( frequency == 0 ) {
+        if ( i < device_speed_count ) {
+            device_speed[i] = device_speed[--device_speed_count];
+        }
+
+        return 1;
+    }
+
+    if ( i == device_speed_count ) {
+        if ( device_speed_count >= I2C_DEVICE_SPEED_COUNT ) {
+            return 0;
+        }
+
+        device_speed_count++;
+    }
+
+    device_speed[i].slave = slave;
+
+    return i2c_calc_speed( frequency, &device_speed[i].speed );
+}
+
+char i2c_write_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode )
+{
+    /* ブロッキング書き込み */
+    I2CSegment segments[2] = { { &address, 1 }, { data, size } };
+
+    return i2c_write_segments( slave, segments, 2, mode );
+}
+
+char i2c_write_segments( uint8_t slave, const I2CSegment *segments, uint8_t count, I2CProcessMode mode )
+{
+    /* ブロッキング書き込み ( キューが空になってから ) */
+    size_t bytes = 1;
+    uint64_t duration;
+    uint8_t i;
+
+    i2c_sim_drain();
+
+    for ( i = 0; i < count; i++ ) {
+        bytes += segments[i].size;
+    }
+
+    duration = i2c_sim_duration( slave, NULL, bytes, 1 );
+    bus_busy += duration;
+    i2c_sim_advance( duration );
+
+    return ( i2c_sim_write( slave, segments, count ) == I2CSuccess );
+}
+
+char i2c_read_register( uint8_t slave, uint8_t address, uint8_t *data, size_t size, I2CProcessMode mode )
+{
+    /* ブロッキング読み込み ( キューが空になってから ) */
+    uint64_t duration;
+
+    i2c_sim_drain();
+
+    duration = i2c_sim_duration( slave, NULL, 3 + size, 2 );
+    bus_busy += duration;
+    i2c_sim_advance( duration );
+
+    return ( i2c_sim_read( slave, address, data, size ) == I2CSuccess );
+}
+
+void i2c_tick( void )
+{
+    /* シミュレーターではバスが固まらない */
+}
+
+void i2c_poll( void )
+{
+}
+
+void i2c_set_timeout( uint8_t ticks )
+{
+    timeout = ticks;
+}
+
+void i2c_recover_bus( void )
+{
+}
+
+char i2c_queue_push( I2CTransaction *transaction )
+{
+    /* キューに入れる ( 先頭になったら今から通信開始 ) */
+    if ( queue.count >= I2C_QUEUE_LENGTH ) {
+        return 0;
+    }
+
+    transaction->status = I2CWorking;
+    queue.items[( queue.head + queue.count ) % I2C_QUEUE_LENGTH] = transaction;
+    queue.count++;
+
+    if ( queue.count == 1 ) {
+        queue_done = now + i2c_sim_transaction_duration( transaction );
+    }
+
+    return 1;
+}
+
+char i2c_queue_busy( void )
+{
+    return ( queue.count != 0 );
+}
+
+void i2c_queue_process( void )
+{
+    /* キューはi2c_sim_advance()で進む */
+}
@@ -0,0 +1,105 @@
+/*
+ * I2Cシミュレーター ( PC用 )
+ *
+ * i2c.cの代わりにリンクすると，i2c_read_register / i2c_write_register / キュー処理が
+ * MPU9150 ( 0x68 ), AK8975 ( 0x0C ), LPS25H ( 0x5C/0x5D ) のレジスターマップを真似た仮想デバイスにつながります．
+ * コンパイル時にI2C_SIMを定義してください．( i2c.hがavrのヘッダーを読まなくなる )
+ *
+ * 時間はすべて仮想時間[ns]です．
+ * バスの通信時間は ( バイト数 * 9 + START/STOP ) / 周波数 で進み，
+ * ブロッキング関数はその分すぐに進め，キューはi2c_sim_advance()で進めた時間の中で完了してコールバックされます．
+ * 同じ入力なら結果は毎回同じになります．
+ *
+ * 再現しているもの
+ *  MPU9150 : WHO_AM_I ( 0x75 = 0x68 ), スリープ ( 0x6B ), SMPLRT_DIV / DLPF_CFGからのサンプルレート,
+ *            INT_STATUS ( 0x3A ) のDATA_RDY ( 読むとクリア ), 0x3B-0x48 ビッグエンディアン, 自動インクリメント,
+ *            INT_PIN_CFG ( 0x37 ) のバイパスが無効ならAK8975はNACK,
+ *            FIFO ( FIFO_EN 0x23, USER_CTRL 0x6A, FIFO_COUNT 0x72-0x73, FIFO_R_W 0x74 ) 1024バイト，溢れると古いバイトから捨ててFIFO_OFLOW_INT,
+ *            INT_ENABLE ( 0x38 ) のDATA_RDY_ENならサンプルごとにINTピンのパルス,
+ *            補助I2Cマスター ( SLV0読み込み -> EXT_SENS_DATA, SLV1書き込み, I2C_MST_DLYでの間引き )
+ *  AK8975  : WIA ( 0x00 = 0x48 ), ヒューズROM ( 0x10-0x12 ), 単発測定 ( 0x0A = 0x01 ) から7.3ms後にST1のDRDY,
+ *            測定後はパワーダウンに戻る, 測定値/ST2を読むとDRDYクリア, リトルエンディアン
+ *  LPS25H  : WHO_AM_I ( 0x0F = 0xBD ), CTRL_REG1 ( 0x20 ) のPDとODR, STATUS_REG ( 0x27 ) のP_DA/T_DA/P_OR/T_OR,
+ *            アドレスのMSB ( 0x80 ) が立っているときだけ自動インクリメント, PRESS_OUT_H / TEMP_OUT_Hを読むとクリア,
+ *            FIFO ( CTRL_REG2 0x21のFIFO_EN, FIFO_CTRL 0x2E, FIFO_STATUS 0x2F ) 32サンプル，
+ *            FIFOが有効なら0x28-0x2Cは一番古いサンプルでTEMP_OUT_Hを読むと次へ ( 0x2Cの次は0x28 ),
+ *            CTRL_REG4 ( 0x23 ) で選んだ信号 ( DRDY, オーバーラン, ウォーターマーク, 空 ) のORをINT1に出す
+ *
+ * 各デバイスはサンプルごとに「読まれたか」を覚えていて，読まれる前に次のサンプルで上書きされたものを落ちたサンプルとして数えます．
+ *
+ * 波形は何も設定しなければチャンネルごとに周波数の違う正弦波です．
+ * i2c_sim_set_waveform()で記録した値の配列を渡すと，サンプル番号ごとに順に ( 最後まで行ったら最初から ) 使います．
+ *
+ */
+
+#ifndef I2C_SIM_H_INCLUDED
+#define I2C_SIM_H_INCLUDED
+
+#include "i2c.h"
+#include <stdio.h>
+
+typedef enum I2CSimChannel_tag {
+    I2CSimAccX,
+    I2CSimAccY,
+    I2CSimAccZ,
+    I2CSimTemp,
+    I2CSimGyroX,
+    I2CSimGyroY,
+    I2CSimGyroZ,
+    I2CSimMagX,
+    I2CSimMagY,
+    I2CSimMagZ,
+    I2CSimPressure,
+    I2CSimPressureTemp,
+    I2C_SIM_CHANNEL_COUNT,
+} I2CSimChannel;
+
+typedef enum I2CSimDeviceType_tag {
+    I2CSimMPU9150,
+    I2CSimAK8975,
+    I2CSimLPS25H,
+    I2C_SIM_DEVICE_COUNT,
+} I2CSimDeviceType;
+
+/* デバイスごとの統計 */
+typedef struct I2CSimStats_tag {
+    uint32_t produced;      /* 作ったサンプル数 */
+    uint32_t read;          /* 読まれたサンプル数 */
+    uint32_t dropped;       /* 読まれる前に上書きされたサンプル数 */
+    uint32_t transactions;  /* このデバイスへのトランザクション数 */
+} I2CSimStats;
+
+/* 割り込みピンが立ったときに呼ばれる ( tはサンプルの時刻 ) */
+typedef void ( *I2CSimIntHandler )( I2CSimDeviceType type, uint64_t t );
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 全デバイスをリセット状態に戻して時間を0にする */
+void i2c_sim_reset( void );
+
+/* LPS25Hのスレーブアドレス ( SDOの状態 ) 初期値0x5D */
+void i2c_sim_set_lps25h_address( uint8_t slave );
+
+/* 記録波形 ( valuesは呼び出し側が保持 ) NULLで正弦波に戻す */
+void i2c_sim_set_waveform( I2CSimChannel channel, const int32_t *values, uint32_t count );
+
+/* 仮想時間 */
+uint64_t i2c_sim_now( void );
+void i2c_sim_advance( uint64_t ns );         /* キューとデバイスを進める */
+void i2c_sim_drain( void );                  /* キューが空になるまで進める */
+uint64_t i2c_sim_bus_busy( void );           /* バスが使われていた合計時間[ns] */
+
+/* 割り込みピン ( MPU9150 INT, LPS25H INT1 ) */
+void i2c_sim_set_int_handler( I2CSimIntHandler handler );
+char i2c_sim_int_level( I2CSimDeviceType type );   /* 今のピンのレベル ( MPU9150は50usパルスなので常に0 ) */
+
+const I2CSimStats *i2c_sim_stats( I2CSimDeviceType type );
+void i2c_sim_report( FILE *out );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#include "imu_pack.h"
+
+static uint8_t imu_pack_width( uint16_t max );
+
+void imu_pack_init( ImuPack *pack )
+{
+    /* 初期化 */
+    pack->frames = 0;
+
+    imu_pack_reset( pack );
+}
+
+void imu_pack_reset( ImuPack *pack )
+{
+    /* 前の値を0に */
+    uint8_t i;
+
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        pack->prev[i] = 0;
+    }
+}
+
+char imu_pack_regular( ImuPack *pack, uint32_t clock )
+{
+    /* 最初の2フレームの間隔で数えた時刻からIMU_PACK_JITTER以内 */
+    int32_t error;
+
+    if ( pack->frames < 2 ) {
+        return 1;
+    }
+
+    error = clock - ( pack->first_clock + pack->interval * pack->frames );
+
+    return ( error >= -IMU_PACK_JITTER && error <= IMU_PACK_JITTER );
+}
+
+char imu_pack_add( ImuPack *pack, uint32_t clock, const int16_t *values )
+{
+    /* 生の値をチャンネルごとの位置にためる */
+    uint8_t *p = &pack->record[IMU_PACK_HEADER_MAX + pack->frames * 2];
+    uint8_t i;
+
+    if ( pack->frames == 0 ) {
+        pack->first_clock = clock;
+    } else if ( pack->frames == 1 ) {
+        pack->interval = clock - pack->first_clock;
+    }
+
+    pack->last_clock = clock;
+
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        p[0] = values[i];
+        p[1] = (uint16_t)values[i] >> 8;
+        p += IMU_PACK_FRAMES * 2;
+    }
+
+    pack->frames++;
+
+    return ( pack->frames >= IMU_PACK_FRAMES );
+}
+
+uint8_t *imu_pack_finish( ImuPack *pack, uint8_t *size )
+{
+    /* 1回目でビット数を決めて，2回目で前から詰める ( 書く位置は読み終えた値を越えない ) */
+    uint8_t widths[IMU_PACK_CHANNELS];
+    uint8_t *in;
+    uint8_t *out;
+    uint8_t *head;
+    uint32_t bits;
+    uint32_t span;
+    uint16_t value;
+    uint16_t max;
+    int16_t prev;
+    uint8_t count;
+    uint8_t i, j;
+
+    /* ビット数 */
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        in   = &pack->record[IMU_PACK_HEADER_MAX + i * IMU_PACK_FRAMES * 2];
+        prev = pack->prev[i];
+        max  = 0;
+
+        for ( j = 0; j < pack->frames; j++, in += 2 ) {
+            value = prev;
+            prev  = in[0] | in[1] << 8;
+            value = prev - value;
+            value = ( value << 1 ) ^ ( ( value & 0x8000 ) ? 0xFFFF : 0 );
+
+            if ( value > max ) {
+                max = value;
+            }
+        }
+
+        widths[i] = imu_pack_width( max );
+    }
+
+    /* 値を詰める */
+    out   = &pack->record[IMU_PACK_HEADER_MAX];
+    bits  = 0;
+    count = 0;
+
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        in = &pack->record[IMU_PACK_HEADER_MAX + i * IMU_PACK_FRAMES * 2];
+
+        for ( j = 0; j < pack->frames; j++, in += 2 ) {
+            value = pack->prev[i];
+            pack->prev[i] = in[0] | in[1] << 8;
+            value = pack->prev[i] - value;
+            value = ( value << 1 ) ^ ( ( value & 0x8000 ) ? 0xFFFF : 0 );
+
+            bits  |= (uint32_t)value << count;
+            count += widths[i];
+
+            while ( count >= 8 ) {
+                *out++ = bits;
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+    }
+
+    if ( count ) {
+        *out++ = bits;
+    }
+
+    /* 前にビット数, 時間, フレーム数 */
+    head = &pack->record[IMU_PACK_HEADER_MAX - IMU_PACK_WIDTH_SIZE];
+
+    for ( i = 0; i < IMU_PACK_WIDTH_SIZE; i++ ) {
+        head[i] = ( ( widths[i * 2] == 16 ) ? 15 : widths[i * 2] );
+
+        if ( i * 2 + 1 < IMU_PACK_CHANNELS ) {
+            head[i] |= ( ( widths[i * 2 + 1] == 16 ) ? 15 : widths[i * 2 + 1] ) << 4;
+        }
+    }
+
+    span = pack->last_clock - pack->first_clock;
+
+    for ( count = 1; ( span >> ( 7 * count ) ) && count < 5; count++ );
+
+    head -= count;
+
+    for ( i = 0; i < count; i++ ) {
+        head[i] = ( span & 0x7F ) | ( ( i + 1 < count ) ? 0x80 : 0 );
+        span >>= 7;
+    }
+
+    *--head = pack->frames;
+
+    pack->frames = 0;
+    *size = out - head;
+
+    return head;
+}
+
+static uint8_t imu_pack_width( uint16_t max )
+{
+    /* maxが入るビット数 ( 15は4bitに収まらないので16 ) */
+    uint8_t width = 0;
+
+    while ( max ) {
+        width++;
+        max >>= 1;
+    }
+
+    return ( width == 15 ) ? 16 : width;
+}
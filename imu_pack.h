@@ -0,0 +1,66 @@
+/*
+ * IMUフレームの可逆圧縮 ( ログ形式v2のID_MPU9150_IMU_PACK )
+ *
+ * IMU_PACK_FRAMESフレームをためて，チャンネルごとに前の値との差 ( 16bitで回り込み ) をzigzag符号化し，
+ * そのブロックの一番大きい値が入るビット数で詰めます．
+ * 前の値はログの時刻同期でリセットするので，時刻同期から読み始めても戻せます．
+ *
+ * レコード ( LOG_V2_RECORD | ID_MPU9150_IMU_PACK, 最初のフレームの時刻の差 ) の後
+ *  サイズ         : 以降のバイト数
+ *  フレーム数     : 1 - IMU_PACK_FRAMES
+ *  時間           : 最初から最後のフレームまで ( 下位7bitずつ，続きがあればMSBが1 )
+ *  ビット数       : チャンネルごとに4bit ( 下位から，15は16bit ) 4バイト
+ *  値             : チャンネルごとにフレーム数分，LSBから詰める
+ * フレームの時刻は最初と最後の間を等間隔に分けたものです．
+ * 間隔がずれるフレーム ( FIFOが溢れて飛んだなど ) はimu_pack_regularで調べて，その前でブロックを切ってください．
+ *
+ * 詰めるのは生の値をためたバッファーの中でそのまま行うので，RAMはレコード1つ分だけです．
+ * 処理はブロックが埋まったときにチャンネル数 * フレーム数の値を2回なめるだけで，ブロックごとに決まった量です．
+ *
+ */
+
+#ifndef IMU_PACK_H_INCLUDED
+#define IMU_PACK_H_INCLUDED
+
+#include <stdint.h>
+
+#define IMU_PACK_FRAMES     8       /* 1ブロックのフレーム数 */
+#define IMU_PACK_CHANNELS   7       /* 加速度xyz, ジャイロxyz, 温度 */
+#define IMU_PACK_WIDTH_SIZE 4       /* ビット数 ( 4bit * チャンネル ) */
+#define IMU_PACK_HEADER_MAX ( 1 + 5 + 1 + 1 + 5 + IMU_PACK_WIDTH_SIZE )   /* ID, 時刻の差, サイズ, フレーム数, 時間, ビット数 */
+#define IMU_PACK_RECORD_MAX ( IMU_PACK_HEADER_MAX + IMU_PACK_FRAMES * IMU_PACK_CHANNELS * 2 )
+#define IMU_PACK_JITTER     1       /* 等間隔とみなす時刻のずれ */
+
+typedef struct {
+    uint8_t frames;                         /* たまったフレーム数 */
+    uint32_t first_clock;
+    uint32_t last_clock;
+    uint32_t interval;                      /* 最初の2フレームの間隔 */
+    int16_t prev[IMU_PACK_CHANNELS];        /* 前に書いたブロックの最後の値 */
+    uint8_t record[IMU_PACK_RECORD_MAX];    /* IMU_PACK_HEADER_MAXから後ろに生の値 ( チャンネルごと ) をためる */
+} ImuPack;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void imu_pack_init( ImuPack *pack );
+void imu_pack_reset( ImuPack *pack );       /* 前の値を0に ( 時刻同期を書いたとき ) */
+
+/* clockのフレームが今のブロックに等間隔で続くか ( 空なら1 ) */
+char imu_pack_regular( ImuPack *pack, uint32_t clock );
+
+/* 1フレーム追加．ブロックが埋まったら1 */
+char imu_pack_add( ImuPack *pack, uint32_t clock, const int16_t *values );
+
+/*
+ * たまったフレームを詰めてサイズ以降の中身の先頭を返す ( sizeに長さ )．
+ * 返した位置の前にIMU_PACK_HEADER_MAX - 10バイト以上空いているので，呼び出し側がID, 時刻の差, サイズを置けます．
+ */
+uint8_t *imu_pack_finish( ImuPack *pack, uint8_t *size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
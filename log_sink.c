@@ -0,0 +1,159 @@
+#include "log_sink.h"
+#include <stddef.h>
+
+void log_sink_init( LogSink *sink, LogSinkWrite write, LogSinkProcess process, void *user )
+{
+    /* 初期化 */
+    sink->write       = write;
+    sink->process     = process;
+    sink->user        = user;
+    sink->policy      = LogSinkDrop;
+    sink->active      = 0;
+    sink->need_header = 0;
+    sink->need_sync   = 0;
+    sink->sync_clock  = 0;
+    sink->dropped     = 0;
+}
+
+void log_sink_start( LogSink *sink, LogSinkPolicy policy )
+{
+    /* 書き込み開始 ( ヘッダーと時刻同期を書くまでレコードは書かない ) */
+    sink->policy      = policy;
+    sink->active      = 1;
+    sink->need_header = 1;
+    sink->need_sync   = 1;
+    sink->dropped     = 0;
+}
+
+void log_sink_stop( LogSink *sink )
+{
+    /* 書き込み停止 */
+    sink->active = 0;
+}
+
+char log_sink_header( LogSink *sink, uint8_t devices )
+{
+    /* シグネチャ, 有効デバイス */
+    uint8_t header[2];
+
+    header[0] = DEVICE_LOG_V2_SIGNATURE;
+    header[1] = devices;
+
+    if ( !sink->active || !log_sink_write( sink, header, 2 ) ) {
+        return 0;
+    }
+
+    sink->need_header = 0;
+    sink->need_sync   = 1;
+
+    return 1;
+}
+
+char log_sink_sync( LogSink *sink, uint32_t clock )
+{
+    /* 書けたら全IDの前の時刻をclockにしてレコードを書けるように */
+    uint8_t sync[LOG_V2_SYNC_SIZE];
+    uint8_t i;
+
+    if ( !sink->active || sink->need_header ) {
+        return 0;
+    }
+
+    sync[0] = LOG_V2_SYNC;
+    sync[1] = clock;
+    sync[2] = clock >> 8;
+    sync[3] = clock >> 16;
+    sync[4] = clock >> 24;
+
+    if ( !log_sink_write( sink, sync, LOG_V2_SYNC_SIZE ) ) {
+        /* 書けなかったので次のループでもう一度 */
+        sink->need_sync = 1;
+
+        return 0;
+    }
+
+    for ( i = 0; i < DEVICE_COUNT; i++ ) {
+        sink->clocks[i] = clock;
+    }
+
+    sink->need_sync  = 0;
+    sink->sync_clock = clock;
+
+    return 1;
+}
+
+char log_sink_sync_due( LogSink *sink, uint32_t now, uint32_t interval )
+{
+    /* ヘッダーを書いた書き込み先で，同期待ちか間隔がたった */
+    if ( !sink->active || sink->need_header ) {
+        return 0;
+    }
+
+    return sink->need_sync || now - sink->sync_clock >= interval;
+}
+
+char log_sink_record( LogSink *sink, uint8_t *data, uint8_t size, uint32_t clock, uint8_t id )
+{
+    /* ID, 同じIDの前のレコードからの時刻の差 ( , サイズ ) をdataの前に作って1回で書く */
+    uint8_t header[LOG_SINK_HEADER_MAX];
+    uint8_t *p = header;
+    int32_t delta;
+    uint32_t value;
+    uint8_t n;
+
+    /* 落としたら同じIDの時刻の差がつながらないので，次の時刻同期まで書かない */
+    if ( !sink->active || sink->need_sync ) {
+        return 0;
+    }
+
+    delta = clock - sink->clocks[id];
+    sink->clocks[id] = clock;
+
+    /* センサーごとに時刻が前後するので符号付き ( zigzag ) で下位7bitずつ */
+    value = ( (uint32_t)delta << 1 ) ^ (uint32_t)( delta >> 31 );
+
+    *p++ = LOG_V2_RECORD | id;
+
+    while ( value >= 0x80 ) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+
+    *p++ = value;
+
+    /* 圧縮したIMUブロックだけは長さが決まっていない */
+    if ( id == ID_MPU9150_IMU_PACK ) {
+        *p++ = size;
+    }
+
+    n = p - header;
+
+    while ( p > header ) {
+        *--data = *--p;
+    }
+
+    if ( !log_sink_write( sink, data, size + n ) ) {
+        sink->dropped++;
+        sink->need_sync = 1;
+
+        return 0;
+    }
+
+    return 1;
+}
+
+char log_sink_write( LogSink *sink, const uint8_t *data, uint8_t size )
+{
+    /* 入らなければpolicyに従って落とすか待つ */
+    while ( !sink->write( data, size, sink->user ) ) {
+        if ( sink->policy == LogSinkDrop ) {
+            return 0;
+        }
+
+        if ( sink->process != NULL && !sink->process( sink->user ) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * ログの書き込み先 ( SDのファイル, USARTなど )
+ *
+ * レコードの中身は1回だけ作って，書き込み先ごとにlog_sink_recordに渡します．
+ * ID, 時刻の差 ( ID_MPU9150_IMU_PACKはサイズも ) は書き込み先ごとの前の時刻から中身の直前に作るので，
+ * 中身の前にLOG_SINK_HEADER_MAXバイト空けておいてください．( 書き込み先ごとに上書きします )
+ * 前の時刻と時刻同期待ちは書き込み先ごとに持つので，一方で落としても，送るレコードが違っても，もう一方はそのままです．
+ * 時刻同期を書く時刻も書き込み先ごとで，log_sink_sync_dueが1の書き込み先にだけlog_sink_syncします．
+ *
+ * 書き込み先はwriteで1レコードを丸ごと受け取り，入らなければ0を返します ( 待たない )．
+ * そのときの扱い ( policy )
+ *  LogSinkDrop : レコードを落として次の時刻同期まで書かない ( センサーの読み込みを止めない )
+ *  LogSinkWait : processを呼びながら入るまで待つ ( 止めるときの残りなど )
+ *
+ */
+
+#ifndef LOG_SINK_H_INCLUDED
+#define LOG_SINK_H_INCLUDED
+
+#include <stdint.h>
+#include "device_id.h"
+
+#define LOG_SINK_HEADER_MAX 7       /* ID, 時刻の差 ( 最大5バイト ), サイズ */
+
+typedef enum {
+    LogSinkDrop,
+    LogSinkWait,
+} LogSinkPolicy;
+
+/* 1レコードを書く．入らなければ0 */
+typedef char (*LogSinkWrite)( const uint8_t *data, uint8_t size, void *user );
+
+/* 待つ間に呼ぶ．もう書けない ( エラー ) なら0 */
+typedef char (*LogSinkProcess)( void *user );
+
+typedef struct {
+    LogSinkWrite write;
+    LogSinkProcess process;             /* NULLなら何もせずに待つ ( 割り込みで空く ) */
+    void *user;
+    LogSinkPolicy policy;
+    char active;
+    char need_header;                   /* 始めたのでファイルヘッダーを書く */
+    char need_sync;                     /* 時刻同期まで書かない */
+    uint32_t sync_clock;                /* 最後に時刻同期を書いた時刻 */
+    uint32_t clocks[DEVICE_COUNT];      /* IDごとの前のレコードの時刻 */
+    uint16_t dropped;                   /* 落としたレコード数 */
+} LogSink;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void log_sink_init( LogSink *sink, LogSinkWrite write, LogSinkProcess process, void *user );
+
+/* 始める ( 次にファイルヘッダーと時刻同期が要る )・止める */
+void log_sink_start( LogSink *sink, LogSinkPolicy policy );
+void log_sink_stop( LogSink *sink );
+
+/* ファイルヘッダー ( シグネチャ, 有効デバイス )．書けたら時刻同期待ちに */
+char log_sink_header( LogSink *sink, uint8_t devices );
+
+/* 時刻同期 ( 全IDの前の時刻をclockにする ) */
+char log_sink_sync( LogSink *sink, uint32_t clock );
+
+/* 時刻同期を書く時か ( 同期待ちか，前の同期からinterval以上たった ) */
+char log_sink_sync_due( LogSink *sink, uint32_t now, uint32_t interval );
+
+/* dataの前にID, 時刻の差を置いて書く ( 止めている，時刻同期待ちなら書かない ) */
+char log_sink_record( LogSink *sink, uint8_t *data, uint8_t size, uint32_t clock, uint8_t id );
+
+/* そのまま書く ( 終了シグネチャなど ) */
+char log_sink_write( LogSink *sink, const uint8_t *data, uint8_t size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
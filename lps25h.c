@@ -1,11 +1,29 @@
 #include "lps25h.h"
 
+static void lps25h_queue_callback( I2CTransaction *transaction );
+static uint8_t lps25h_fifo_check( LPS25HUnit *unit, uint8_t status );
+
 char lps25h_init( LPS25HUnit *unit, uint8_t address, LPS25HDataRate rate, LPS25HPresAvg pres_avg, LPS25HTempAvg temp_avg )
 {
     /* 初期化 */
     uint8_t data;
     unit->address = address;
 
+    /* キュー読み込み準備 */
+    unit->transaction.slave    = address;
+    unit->transaction.rw       = I2CR;
+    unit->transaction.data     = unit->buffer;
+    unit->transaction.callback = lps25h_queue_callback;
+    unit->transaction.user     = unit;
+    unit->transaction.speed    = NULL;
+    unit->transaction.status   = I2CSuccess;
+    unit->fresh = 0;
+
+    unit->fifo_samples  = 0;
+    unit->fifo_pos      = 0;
+    unit->fifo_count    = 0;
+    unit->fifo_overflow = 0;
+
     /* デバイスID確認 */
     if ( !i2c_read_register( unit->address, 0x0F, &data, 1, I2CPolling ) ) {
         return 0;
@@ -30,6 +48,29 @@ char lps25h_init( LPS25HUnit *unit, uint8_t address, LPS25HDataRate rate, LPS25H
         return 0;
     }
 
+    /* サンプル周期 */
+    switch ( rate ) {
+    case LPS25H1_1Hz:
+        unit->sample_period = 1000000UL;
+        break;
+
+    case LPS25H7_7Hz:
+        unit->sample_period = 142857UL;
+        break;
+
+    case LPS25H12dot5_12dot5Hz:
+        unit->sample_period = 80000UL;
+        break;
+
+    case LPS25H25_25Hz:
+        unit->sample_period = 40000UL;
+        break;
+
+    default:
+        unit->sample_period = 0;
+        break;
+    }
+
     /* データレート設定，読み出し中のデータロック */
     data = 0x04 | rate;
 
@@ -117,6 +158,25 @@ char lps25h_read( LPS25HUnit *unit )
     return 1;
 }
 
+char lps25h_poll_read( LPS25HUnit *unit )
+{
+    /* STATUS_REG ( 0x27 ) から気圧 ( 0x28-0x2A ) まで続けて読み，気圧データ準備完了なら1 */
+    uint8_t data[4];
+
+    /* マルチバイトリードを行うにはMSBを1にする必要がある */
+    if ( !i2c_read_register( unit->address, 0x27 | 0x80, data, 4, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !( data[0] & 0x02 ) ) {
+        return 0;
+    }
+
+    unit->pressure = (int32_t)data[1] | ( (int32_t)data[2] << 8 ) | ( (int32_t)data[3] << 16 );
+
+    return 1;
+}
+
 char lps25h_read_temp( LPS25HUnit *unit )
 {
     /* 温度データーを読む */
@@ -146,3 +206,214 @@ char lps25h_one_shot( LPS25HUnit *unit )
 
     return 1;
 }
+
+char lps25h_int_enable( LPS25HUnit *unit, uint8_t sources )
+{
+    /* INT1にデータ信号を出す */
+    uint8_t data;
+
+    /* CTRL_REG3: アクティブH, プッシュプル, データ信号 */
+    data = 0x00;
+
+    if ( !i2c_write_register( unit->address, 0x22, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    /* CTRL_REG4: 出す信号 */
+    data = sources & 0x0F;
+
+    if ( !i2c_write_register( unit->address, 0x23, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static void lps25h_queue_callback( I2CTransaction *transaction )
+{
+    /* 割り込み中: 気圧データ準備完了ならデータを使えるようにする ( FIFOならFIFO_STATUS -> バースト ) */
+    LPS25HUnit *unit = transaction->user;
+    uint8_t samples;
+
+    if ( transaction->status != I2CSuccess ) {
+        return;
+    }
+
+    switch ( transaction->address ) {
+    case 0x27 | 0x80:
+        /* STATUS_REG + 気圧 */
+        unit->fresh = ( unit->buffer[0] & 0x02 ) ? 1 : 0;
+        break;
+
+    case 0x2F:
+        /* FIFO_STATUS */
+        if ( ( samples = lps25h_fifo_check( unit, unit->buffer[0] ) ) ) {
+            transaction->address = 0x28 | 0x80;
+            transaction->data    = unit->fifo_buffer;
+            transaction->size    = samples * LPS25H_FIFO_SAMPLE_SIZE;
+
+            i2c_queue_push( transaction );
+        }
+        break;
+
+    case 0x28 | 0x80:
+        /* 気圧・温度 */
+        unit->fifo_samples = transaction->size / LPS25H_FIFO_SAMPLE_SIZE;
+        break;
+
+    default:
+        break;
+    }
+}
+
+char lps25h_queue_read( LPS25HUnit *unit )
+{
+    /* STATUS_REGと気圧の読み込みをキューに入れる ( マルチバイトリードなのでMSBを1に ) */
+    unit->transaction.address = 0x27 | 0x80;
+    unit->transaction.data    = unit->buffer;
+    unit->transaction.size    = 4;
+
+    return i2c_queue_push( &unit->transaction );
+}
+
+char lps25h_queue_busy( LPS25HUnit *unit )
+{
+    /* キュー読み込み中か */
+    return ( unit->transaction.status == I2CWorking );
+}
+
+char lps25h_queue_fetch( LPS25HUnit *unit )
+{
+    /* キュー読み込みで新しいデータが来ていれば1 */
+    if ( lps25h_queue_busy( unit ) || !unit->fresh ) {
+        return 0;
+    }
+
+    unit->pressure = (int32_t)unit->buffer[1] | ( (int32_t)unit->buffer[2] << 8 ) | ( (int32_t)unit->buffer[3] << 16 );
+    unit->fresh = 0;
+
+    return 1;
+}
+
+char lps25h_fifo_enable( LPS25HUnit *unit, uint8_t watermark )
+{
+    /* ストリームモードでFIFO有効 */
+    uint8_t data;
+
+    /* FIFO_CTRL: ストリームモード, ウォーターマーク */
+    data = 0x40 | ( watermark & 0x1F );
+
+    if ( !i2c_write_register( unit->address, 0x2E, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    /* CTRL_REG2: FIFO_EN, WTM_EN */
+    data = 0x60;
+
+    if ( !i2c_write_register( unit->address, 0x21, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_samples = 0;
+    unit->fifo_pos     = 0;
+
+    return 1;
+}
+
+char lps25h_fifo_disable( LPS25HUnit *unit )
+{
+    /* バイパスモードに戻す */
+    uint8_t data;
+
+    data = 0x00;
+
+    if ( !i2c_write_register( unit->address, 0x21, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !i2c_write_register( unit->address, 0x2E, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_samples = 0;
+    unit->fifo_pos     = 0;
+
+    return 1;
+}
+
+static uint8_t lps25h_fifo_check( LPS25HUnit *unit, uint8_t status )
+{
+    /* FIFO_STATUSからたまっている数を覚えて，今回読むサンプル数を返す */
+    if ( status & 0x40 ) {
+        /* FULL_FIFO */
+        unit->fifo_count = LPS25H_FIFO_SIZE;
+        unit->fifo_overflow++;
+    } else {
+        unit->fifo_count = status & 0x1F;
+    }
+
+    if ( unit->fifo_count > LPS25H_FIFO_BURST ) {
+        return LPS25H_FIFO_BURST;
+    }
+
+    return unit->fifo_count;
+}
+
+char lps25h_fifo_read( LPS25HUnit *unit )
+{
+    /* FIFO_STATUSを読んで，たまっているサンプルをまとめて読む */
+    uint8_t samples;
+
+    unit->fifo_samples = 0;
+    unit->fifo_pos     = 0;
+
+    if ( !i2c_read_register( unit->address, 0x2F, unit->buffer, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    samples = lps25h_fifo_check( unit, unit->buffer[0] );
+
+    if ( samples == 0 ) {
+        return 1;
+    }
+
+    /* マルチバイトリードを行うにはMSBを1にする必要がある */
+    if ( !i2c_read_register( unit->address, 0x28 | 0x80, unit->fifo_buffer, samples * LPS25H_FIFO_SAMPLE_SIZE, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_samples = samples;
+
+    return 1;
+}
+
+char lps25h_fifo_queue_read( LPS25HUnit *unit )
+{
+    /* FIFO_STATUS確認をキューに入れる ( たまっていれば続けてバースト読み込み ) */
+    unit->fifo_samples = 0;
+    unit->fifo_pos     = 0;
+
+    unit->transaction.address = 0x2F;
+    unit->transaction.data    = unit->buffer;
+    unit->transaction.size    = 1;
+
+    return i2c_queue_push( &unit->transaction );
+}
+
+char lps25h_fifo_fetch( LPS25HUnit *unit )
+{
+    /* 読んだサンプルを1つ取り出す */
+    const uint8_t *data;
+
+    if ( lps25h_queue_busy( unit ) || unit->fifo_pos >= unit->fifo_samples ) {
+        return 0;
+    }
+
+    data = &unit->fifo_buffer[unit->fifo_pos * LPS25H_FIFO_SAMPLE_SIZE];
+
+    unit->pressure = (int32_t)data[0] | ( (int32_t)data[1] << 8 ) | ( (int32_t)data[2] << 16 );
+    unit->temp     = (int16_t)( data[3] | ( data[4] << 8 ) );
+    unit->fifo_pos++;
+
+    return 1;
+}
@@ -15,6 +15,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+/*
+ * FIFO
+ *  lps25h_fifo_enable()でストリームモード ( 32サンプル，溢れたら古いものから捨てる ) にすると，
+ *  FIFO_STATUSでたまっている数を読んでから，気圧と温度 ( 0x28-0x2C ) をLPS25H_FIFO_BURSTサンプルまで1回のバーストで読める．
+ *  FIFOが有効な間は0x2Cの次は0x28に戻るので，続けて読むと次のサンプルになる．
+ *  FIFOがいっぱいだった ( 古いサンプルが捨てられたかもしれない ) ときはfifo_overflowを1増やす．
+ *  ウォーターマークはFIFO_STATUSのWTM_FIFOとINT_DRDYピン用．
+ */
+#define LPS25H_FIFO_SIZE        32
+#define LPS25H_FIFO_SAMPLE_SIZE 5       /* PRESS_OUT_XL-H, TEMP_OUT_L-H */
+#define LPS25H_FIFO_BURST       8       /* 1回で読むサンプル数 ( RAMに合わせて ) */
+
 typedef enum LPS25HTempAvg_tag {
     LPS25HTempAvg8   = 0x00,
     LPS25HTempAvg16  = 0x04,
@@ -37,11 +49,32 @@ typedef enum LPS25HDataRate_tag {
     LPS25H25_25Hz         = 0x40,
 } LPS25HDataRate;
 
+/* INT1 ( INT_DRDY ) ピンに出す信号 ( CTRL_REG4 ) */
+typedef enum LPS25HInt_tag {
+    LPS25HIntDataReady = 0x01,
+    LPS25HIntOverrun   = 0x02,
+    LPS25HIntWatermark = 0x04,
+    LPS25HIntEmpty     = 0x08,
+} LPS25HInt;
+
 typedef struct LPS25HUnit_tag {
     uint8_t address;
     int32_t pressure;
     int16_t temp;
     uint8_t ctrl_1;
+    uint32_t sample_period;     /* サンプル周期[us] ( ワンショットなら0 ) */
+
+    /* キュー読み込み用 */
+    I2CTransaction transaction;
+    uint8_t buffer[4];      /* STATUS_REG, PRESS_OUT_XL-H */
+    volatile char fresh;
+
+    /* FIFO用 */
+    uint8_t fifo_buffer[LPS25H_FIFO_BURST * LPS25H_FIFO_SAMPLE_SIZE];
+    volatile uint8_t fifo_samples;      /* fifo_bufferに入っているサンプル数 */
+    uint8_t fifo_pos;                   /* 次に取り出すサンプル */
+    uint8_t fifo_count;                 /* 最後に読んだFIFOのサンプル数 */
+    volatile uint16_t fifo_overflow;    /* いっぱいだった回数 */
 } LPS25HUnit;
 
 #ifdef __cplusplus
@@ -52,10 +85,24 @@ char lps25h_init( LPS25HUnit *unit, uint8_t address, LPS25HDataRate rate, LPS25H
 char lps25h_start( LPS25HUnit *unit );
 char lps25h_stop( LPS25HUnit *unit );
 char lps25h_one_shot( LPS25HUnit *unit );
+char lps25h_int_enable( LPS25HUnit *unit, uint8_t sources );    /* LPS25HIntの組み合わせをINT1にアクティブHで出す */
 char lps25h_data_ready( LPS25HUnit *unit );
 char lps25h_temp_data_ready( LPS25HUnit *unit );
 char lps25h_read( LPS25HUnit *unit );
 char lps25h_read_temp( LPS25HUnit *unit );
+char lps25h_poll_read( LPS25HUnit *unit );      /* STATUS_REGと気圧を1回で読む．新しいデータなら1 */
+
+/* TWI割り込みキューで STATUS_REGと気圧を1回で読む ( データレディーのときだけfetchできる ) */
+char lps25h_queue_read( LPS25HUnit *unit );
+char lps25h_queue_busy( LPS25HUnit *unit );
+char lps25h_queue_fetch( LPS25HUnit *unit );
+
+/* FIFO */
+char lps25h_fifo_enable( LPS25HUnit *unit, uint8_t watermark );
+char lps25h_fifo_disable( LPS25HUnit *unit );
+char lps25h_fifo_read( LPS25HUnit *unit );              /* FIFO_STATUS -> バースト読み込み ( ブロッキング ) */
+char lps25h_fifo_queue_read( LPS25HUnit *unit );        /* 同じことをTWI割り込みキューで */
+char lps25h_fifo_fetch( LPS25HUnit *unit );             /* 読んだサンプルを1つpressureとtempに入れる．なければ0 */
 
 #ifdef __cplusplus
 }
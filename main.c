@@ -8,13 +8,20 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <stdlib.h>
+#include <string.h>
 #include "sd.h"
 #include "lps25h.h"
 #include "ak8975.h"
 #include "mpu9150.h"
 #include "micomfs.h"
+#include "sd_stage.h"
+#include "log_sink.h"
 #include "usart.h"
 #include "device_id.h"
+#include "imu_pack.h"
+#include "frame.h"
+#include "decimate.h"
+#include "sensor_schedule.h"
 
 #define LED_STATUS    _BV( PD7 )
 #define SW_START_STOP _BV( PD4 )
@@ -22,10 +29,46 @@
 #define SW_MASK       ( SW_START_STOP | SW_FORMAT )
 #define IR_INPUT      _BV( PD2 )
 
+
+#define RECORD_MAX_SIZE     ( LOG_SINK_HEADER_MAX + 14 )
+#define LOG_SYNC_INTERVAL   10000   /* 時刻同期を入れる間隔 ( 1秒 ) */
+#define MAG_AUX_DELAY       9       /* 地磁気はMPU9150の( 1 + MAG_AUX_DELAY )フレームごと */
+#define PREVIEW_IMU_PERIOD  100000UL    /* プレビューの既定のIMUと地磁気の周期[us] ( 10Hz ) */
+#define PREVIEW_PRES_PERIOD 1000000UL   /* プレビューの既定の気圧と温度の周期[us] ( 1Hz ) */
+
+/*
+ * SENSOR_INTを定義すると ( make SENSOR_INT=1 ) センサーの割り込みピンを使う
+ *  MPU9150 INT  -> PD3 ( INT1 )    : サンプルごとの50usパルス．時刻を覚えてFIFOのフレームに付ける
+ *  LPS25H  INT1 -> PD6 ( PCINT22 ) : FIFOのウォーターマーク．立ったら読む
+ * 時刻はループの先頭ではなくセンサーがサンプルを出した時刻になり，FIFOが空のときに読みに行かなくなる．
+ */
+#ifdef SENSOR_INT
+#define MPU_INT             _BV( PD3 )
+#define PRESS_INT           _BV( PD6 )
+#define SENSOR_USE_INT      1
+#define PRESS_INT_LEVEL()   ( ( PIND & PRESS_INT ) != 0 )
+#else
+#define SENSOR_USE_INT      0
+#define PRESS_INT_LEVEL()   0
+#endif
+
+/* ログの書き込み先 ( 同時に書ける ) */
+typedef enum {
+    SinkSD,
+    SinkUSART,
+    SinkCount,
+} SinkIndex;
+
+#define SINK_ALL ( _BV( SinkSD ) | _BV( SinkUSART ) )
+
+/* プレビューで間引くチャンネル */
 typedef enum {
-    WriteToSD,
-    WriteToUSART,
-} WritingTarget;
+    PreviewPres,
+    PreviewPresTemp,
+    PreviewIMU,
+    PreviewMag,
+    PreviewCount,
+} PreviewIndex;
 
 static volatile uint32_t system_clock;  /* 100usごとにカウントされるタイマー */
 static uint16_t input_counter;
@@ -33,50 +76,116 @@ static volatile uint8_t input;
 
 static Devices all_sensors;
 static volatile Devices enabled_dev;
-static volatile Devices write_dev;
+static Devices write_dev;
 static Devices updated_dev;
-static volatile WritingTarget target;
+static volatile uint8_t usart_need_start;   /* 送信開始の要求 ( TRANSMIT_STARTかTRANSMIT_PREVIEW_START ) が来た */
+static volatile char usart_need_stop;       /* 送信停止の要求が来た */
+static volatile char usart_need_ack;        /* ハンドシェイクの応答を返す */
+static volatile char usart_need_baud;       /* ボーレート変更の要求が来た */
+static volatile uint8_t usart_baud_request; /* 要求されたボーレート番号 */
+static uint8_t usart_baud;                  /* 今のボーレート番号 */
+static uint8_t usart_baud_next;             /* 応答を送り終えたら切り替えるボーレート番号 */
+static char usart_baud_switch;              /* 応答を送り終えるのを待っている */
+static char usart_baud_check;               /* 切り替えた後のハンドシェイク待ち */
+static uint32_t usart_baud_clock;           /* 切り替えた時刻 */
+static volatile char usart_need_ratio;      /* 間引く数の変更が来た */
+static volatile uint8_t usart_ratio_request[3];     /* ID, サンプル数 */
+static char usart_preview;                  /* USARTへは間引いて送る */
+static Decimator previews[PreviewCount];    /* チャンネルごとの間引き */
+static int32_t preview_sums[1 + 1 + 7 + 3]; /* 気圧, 温度, IMU, 地磁気の値ごとの合計 */
+static LogSink sinks[SinkCount];            /* ログの書き込み先 */
+static SDStage stage;                       /* SD書き込みの2面バッファー */
+static Frame usart_frame;                   /* USARTへ送るフレーム */
+#ifdef LOG_PACK
+static ImuPack imu_pack;                    /* 圧縮待ちのIMUフレーム */
+#endif
+
+static SensorPoll sensor;                    /* センサー読み込みの予定と時刻 ( 割り込みピンの時刻も ) */
 
 static void fatal_error( void );
 static void onoff_led( void );
 static void sensor_init_error( void );
+static uint8_t *record_put16( uint8_t *p, int16_t value );
+static uint8_t *record_put32( uint8_t *p, int32_t value );
+static void record_write( uint8_t *data, uint8_t size, uint32_t clock, uint8_t id, uint8_t mask );
+static void log_sync( uint8_t index, uint32_t clock );
+static void log_update_devices( void );
+static Decimator *preview_find( uint8_t id );
+static uint16_t preview_ratio( uint32_t period, uint32_t sample_period );
+static char sd_sink_write( const uint8_t *data, uint8_t size, void *user );
+static char sd_sink_process( void *user );
+static char usart_sink_write( const uint8_t *data, uint8_t size, void *user );
+static char usart_frame_send( void );
+static void usart_link_process( uint32_t now );
+static void usart_set_baud( uint8_t baud );
+#ifdef LOG_PACK
+static void record_write_pack( void );
+#endif
 
 ISR( USART_RX_vect )
 {
     /* USART受信割り込み */
-    uint8_t data = 0;
+    static uint8_t command;     /* 引数を待っているコマンド */
+    static uint8_t args[3];
+    static uint8_t arg_count;
+    uint8_t data;
+    uint8_t i;
 
     /* 読める限り */
     while ( usart_can_read() ) {
         /* 読む */
         data = usart_read();
-    }
 
-    // Handling
-    if ( data == TRANSMIT_START ) {
-        if ( !write_dev ) {
-            // Start data transmit
-            write_dev = enabled_dev & ( DEV_MAG | DEV_GYRO | DEV_ACC | DEV_PRESS | DEV_TEMP );
-            target = WriteToUSART;
+        if ( command ) {
+            // Arguments
+            args[arg_count++] = data;
+
+            if ( command == TRANSMIT_BAUD ) {
+                // Baud rate number
+                command = 0;
+                usart_baud_request = args[0];
+                usart_need_baud = 1;
+            } else if ( command == TRANSMIT_PREVIEW_RATIO && arg_count == 3 ) {
+                // ID, ratio
+                command = 0;
+
+                for ( i = 0; i < 3; i++ ) {
+                    usart_ratio_request[i] = args[i];
+                }
+
+                usart_need_ratio = 1;
+            }
+
+            continue;
         }
-    } else if ( data == TRANSMIT_STOP ) {
-        if ( write_dev && target == WriteToUSART ) {
-            // Stop data transmit
-            write_dev = 0;
 
-            // LED off
-            PORTD &= ~LED_STATUS;
+        // Handling
+        if ( data == TRANSMIT_START || data == TRANSMIT_PREVIEW_START ) {
+            // Start data transmit ( 書き込み先を変えるのはメインループだけ )
+            usart_need_start = data;
+        } else if ( data == TRANSMIT_STOP ) {
+            // Stop data transmit
+            usart_need_stop = 1;
+        } else if ( data == TRANSMIT_HANDSHAKE ) {
+            // Hand shake ( 送信バッファーに書くのはメインループだけ )
+            usart_need_ack = 1;
+        } else if ( data == TRANSMIT_BAUD || data == TRANSMIT_PREVIEW_RATIO ) {
+            // Wait arguments
+            command   = data;
+            arg_count = 0;
+        } else {
+            // Unknown date
+            // fatal();
         }
-    } else if ( data == TRANSMIT_HANDSHAKE ) {
-        // Hand shake
-        while ( !usart_can_write() );
-        usart_write( TRANSMIT_HANDSHAKE_ACK );
-    } else {
-        // Unknown date
-        // fatal();
     }
 }
 
+ISR( TWI_vect )
+{
+    /* I2Cキュー処理 */
+    i2c_queue_process();
+}
+
 ISR( TIMER0_COMPA_vect )
 {
     /* タイマー0コンペアマッチA割り込みベクター */
@@ -84,6 +193,9 @@ ISR( TIMER0_COMPA_vect )
     /* システムクロックを100usごとに1更新 */
     system_clock++;
 
+    /* I2Cのタイムアウト監視 */
+    i2c_tick();
+
     /* 50msごとに入力読み込み ( チャタリング防止 ) */
     if ( 500 <= input_counter ) {
         /* Read PD value with input pin masks */
@@ -95,6 +207,303 @@ ISR( TIMER0_COMPA_vect )
     }
 }
 
+#ifdef SENSOR_INT
+ISR( INT1_vect )
+{
+    /* MPU9150のデータレディー: 1フレームFIFOに入ったので時刻を覚える */
+    sensor_poll_mpu_int( &sensor, system_clock );
+}
+
+ISR( PCINT2_vect )
+{
+    /* LPS25Hのウォーターマーク ( 立ち上がりだけ ) */
+    if ( PIND & PRESS_INT ) {
+        sensor_poll_pres_int( &sensor, system_clock );
+    }
+}
+#endif
+
+static uint8_t *record_put16( uint8_t *p, int16_t value )
+{
+    /* リトルエンディアンで2バイト */
+    p[0] = value;
+    p[1] = (uint16_t)value >> 8;
+
+    return p + 2;
+}
+
+static uint8_t *record_put32( uint8_t *p, int32_t value )
+{
+    /* リトルエンディアンで4バイト */
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+
+    return p + 4;
+}
+
+static void record_write( uint8_t *data, uint8_t size, uint32_t clock, uint8_t id, uint8_t mask )
+{
+    /* 1回作った中身をmaskの書き込み先へ ( ID, 時刻の差は書き込み先ごとに前に置く ) */
+    Decimator *dec;
+    uint8_t i;
+
+    for ( i = 0; i < SinkCount; i++ ) {
+        if ( !( mask & _BV( i ) ) ) {
+            continue;
+        }
+
+        /* プレビューは平均がたまったときだけ ( 平均は中身に書き戻すのでUSARTは最後 ) */
+        if ( i == SinkUSART && usart_preview ) {
+            dec = preview_find( id );
+
+            if ( !sinks[i].active || dec == NULL || !decimate_add( dec, data, &clock ) ) {
+                continue;
+            }
+        }
+
+        log_sink_record( &sinks[i], data, size, clock, id );
+    }
+}
+
+static void log_sync( uint8_t index, uint32_t clock )
+{
+    /* 1つの書き込み先に時刻同期 ( 書けなければneed_syncのままなので次のループでもう一度 ) */
+    if ( !log_sink_sync( &sinks[index], clock ) ) {
+        return;
+    }
+
+#ifdef LOG_PACK
+    /* 圧縮の前の値も同期から ( 圧縮するのはSDだけなのでSDに同期が書けたときだけ ) */
+    if ( index == SinkSD ) {
+        imu_pack_reset( &imu_pack );
+    }
+#endif
+}
+
+static void log_update_devices( void )
+{
+    /* どれかに書き込み中なら測定する */
+    if ( sinks[SinkSD].active || sinks[SinkUSART].active ) {
+        if ( !write_dev ) {
+            write_dev = enabled_dev & all_sensors;
+        }
+    } else {
+        write_dev = 0;
+    }
+}
+
+static Decimator *preview_find( uint8_t id )
+{
+    /* IDのプレビューの間引き ( 間引けないIDはNULL ) */
+    switch ( id ) {
+    case ID_LPS331AP:
+        return &previews[PreviewPres];
+
+    case ID_LPS331AP_TEMP:
+        return &previews[PreviewPresTemp];
+
+    case ID_MPU9150_IMU:
+        return &previews[PreviewIMU];
+
+    case ID_AK8975:
+        return &previews[PreviewMag];
+
+    default:
+        return NULL;
+    }
+}
+
+static uint16_t preview_ratio( uint32_t period, uint32_t sample_period )
+{
+    /* periodごとに1つにするサンプル数 */
+    if ( sample_period == 0 || sample_period >= period ) {
+        return 1;
+    }
+
+    return period / sample_period;
+}
+
+static char sd_sink_write( const uint8_t *data, uint8_t size, void *user )
+{
+    /* SDの2面バッファーへ */
+    return sd_stage_write( user, data, size );
+}
+
+static char sd_sink_process( void *user )
+{
+    /* 書き込み中のバッファーを進める */
+    SDStage *stage = user;
+
+    sd_stage_process( stage );
+
+    return !stage->error;
+}
+
+static char usart_sink_write( const uint8_t *data, uint8_t size, void *user )
+{
+    /* フレームにためる ( 入らなければ今のフレームを送ってから，送れなければフレームはそのまま ) */
+    if ( usart_frame.size + size > FRAME_DATA_MAX && !usart_frame_send() ) {
+        return 0;
+    }
+
+    return frame_add( &usart_frame, data, size );
+}
+
+static char usart_frame_send( void )
+{
+    /* たまったフレームを送信バッファーへ ( 全部入らなければ送らずに0 ) */
+    uint8_t *data;
+    uint8_t size;
+
+    if ( usart_tx_space() < usart_frame.size + FRAME_OVERHEAD ) {
+        return 0;
+    }
+
+    data = frame_encode( &usart_frame, &size );
+    usart_write_buf( data, size );
+
+    return 1;
+}
+
+static void usart_link_process( uint32_t now )
+{
+    /* PCからのコマンドに応答して，必要ならボーレートを切り替える */
+    Decimator *dec;
+    uint8_t request[3];
+    uint8_t reply[2];
+    uint8_t i;
+
+    /* 送信開始 ( SDに書き込み中でも同時に送る．送信中ならプレビューかどうかだけ切り替える ) */
+    if ( usart_need_start ) {
+        usart_preview    = ( usart_need_start == TRANSMIT_PREVIEW_START );
+        usart_need_start = 0;
+
+        for ( i = 0; i < PreviewCount; i++ ) {
+            decimate_reset( &previews[i] );
+        }
+
+        if ( !sinks[SinkUSART].active ) {
+            log_sink_start( &sinks[SinkUSART], LogSinkDrop );
+            log_update_devices();
+        }
+    }
+
+    /* プレビューの間引く数 */
+    if ( usart_need_ratio ) {
+        cli();
+        for ( i = 0; i < 3; i++ ) {
+            request[i] = usart_ratio_request[i];
+        }
+        usart_need_ratio = 0;
+        sei();
+
+        if ( ( dec = preview_find( request[0] ) ) != NULL ) {
+            decimate_set_ratio( dec, request[1] | request[2] << 8 );
+        }
+    }
+
+    /* 送信停止 ( 終了シグネチャまで送る ) */
+    if ( usart_need_stop ) {
+        usart_need_stop = 0;
+
+        if ( sinks[SinkUSART].active ) {
+            reply[0] = LOG_END_SIGNATURE;
+            sinks[SinkUSART].policy = LogSinkWait;
+            log_sink_write( &sinks[SinkUSART], reply, 1 );
+
+            log_sink_stop( &sinks[SinkUSART] );
+            log_update_devices();
+
+            // LED off
+            if ( !write_dev ) {
+                PORTD &= ~LED_STATUS;
+            }
+        }
+    }
+
+    /* 送信バッファーが空いたらたまった分をフレームで送る ( 混んでいる間はフレームが大きくなる，止めた後の残りも ) */
+    if ( usart_frame.size && usart_tx_empty() ) {
+        usart_frame_send();
+    }
+
+    /* ハンドシェイク ( 切り替えた後なら新しいボーレートで通じた ) */
+    if ( usart_need_ack && usart_tx_space() >= 2 ) {
+        reply[0] = TRANSMIT_HANDSHAKE_ACK;
+        reply[1] = 0;
+
+        /* フレームを送っている間は区切りを付けて，次のフレームを巻き込まないように */
+        if ( usart_write_buf( reply, sinks[SinkUSART].active ? 2 : 1 ) ) {
+            usart_need_ack   = 0;
+            usart_baud_check = 0;
+        }
+    }
+
+    /* ボーレート変更 ( USARTへ送信中と知らない番号は受け付けず今の番号を返す ) */
+    if ( usart_need_baud && !usart_baud_switch && usart_tx_space() >= 2 ) {
+        usart_need_baud = 0;
+
+        reply[0] = TRANSMIT_HANDSHAKE_ACK;
+        reply[1] = usart_baud_request;
+
+        if ( sinks[SinkUSART].active || reply[1] >= TRANSMIT_BAUD_COUNT ) {
+            reply[1] = usart_baud;
+        }
+
+        usart_write_buf( reply, 2 );
+
+        if ( reply[1] != usart_baud ) {
+            usart_baud_next   = reply[1];
+            usart_baud_switch = 1;
+        }
+    }
+
+    /* 応答を出し終えたら切り替える */
+    if ( usart_baud_switch && usart_tx_complete() ) {
+        usart_baud_switch = 0;
+        usart_set_baud( usart_baud_next );
+
+        usart_baud_check = ( usart_baud != TRANSMIT_BAUD_9600 );
+        usart_baud_clock = now;
+    }
+
+    /* 新しいボーレートでハンドシェイクが来なければ戻す */
+    if ( usart_baud_check && now - usart_baud_clock >= TRANSMIT_BAUD_TIMEOUT ) {
+        usart_baud_check = 0;
+        usart_set_baud( TRANSMIT_BAUD_9600 );
+    }
+}
+
+static void usart_set_baud( uint8_t baud )
+{
+    /* ボーレート番号で初期化し直す ( 8MHzでも誤差が出ないようにU2X ) */
+    static const uint32_t bps[TRANSMIT_BAUD_COUNT] = { 9600, 250000, 500000, 1000000 };
+
+    cli();
+    usart_init( bps[baud], UsartRX | UsartTX | Usart2X, UsartIntRX );
+    sei();
+
+    usart_baud = baud;
+}
+
+#ifdef LOG_PACK
+static void record_write_pack( void )
+{
+    /* たまったIMUフレームを詰めてSDへ ( 前にID, 時刻の差, サイズを置く場所は空いている ) */
+    uint8_t *data;
+    uint8_t size;
+
+    if ( !imu_pack.frames ) {
+        return;
+    }
+
+    data = imu_pack_finish( &imu_pack, &size );
+
+    record_write( data, size, imu_pack.first_clock, ID_MPU9150_IMU_PACK, _BV( SinkSD ) );
+}
+#endif
+
 void fatal_error( void )
 {
     /* 致命的な問題が起きたのでLED点滅 */
@@ -130,7 +539,6 @@ void onoff_led( void )
 int main( void )
 {
     /* sensor3 制御プログラム */
-    int i;
     uint32_t before_system_clock;
     uint32_t now_system_clock;
 
@@ -147,9 +555,18 @@ int main( void )
     MicomFSFile fp;
     char file_name[16];
 
-    uint8_t data;
+    uint8_t end;
     char ret;
 
+    uint8_t record[RECORD_MAX_SIZE];
+    uint8_t *data;
+    uint8_t *p;
+    uint8_t mask;
+    uint8_t i;
+#ifdef LOG_PACK
+    int16_t frame[IMU_PACK_CHANNELS];
+#endif
+
     /* 割り込み停止 */
     cli();
 
@@ -173,31 +590,52 @@ int main( void )
     TIMSK0 = 0x02;          /* コンペアマッチA割り込み有効 */
     OCR0A  = 100;           /* 100usごとに割りこみ発生 */
 
+#ifdef SENSOR_INT
+    /* センサーの割り込みピン ( プッシュプル出力なのでプルアップなし ) */
+    PORTD &= ~( MPU_INT | PRESS_INT );
+    EICRA  = _BV( ISC11 ) | _BV( ISC10 );   /* INT1立ち上がり */
+    EIMSK  = _BV( INT1 );
+    PCMSK2 = _BV( PCINT22 );
+    PCICR  = _BV( PCIE2 );
+#endif
+
     // Initialize USART
     usart_init( 9600, UsartRX | UsartTX, UsartIntRX );
 
-    /* I2Cバス初期化 */
-    i2c_init_master( 15, I2CPrescale1, 0, 0 );
+    /* I2Cバス初期化 ( MPU9150, AK8975, LPS25Hはすべて400kHzに対応 ) */
+    i2c_init_master( 400000UL, 0, 0 );
 
     /* デバイス初期化 */
-    all_sensors = DEV_MAG | DEV_GYRO | DEV_ACC | DEV_PRESS | DEV_TEMP;
+    all_sensors = DEV_MAG | DEV_GYRO | DEV_ACC | DEV_PRESS | DEV_TEMP | DEV_PRESS_TEMP;
     enabled_dev = 0;
 
     if ( sd_init( SPIOscDiv2, 512, 0 ) ) {
         enabled_dev |= DEV_SD;
     }
 
-    if ( mpu9150_init( &mpu9150, 0x68, 0, MPU9150LPFCFG0, MPU9150AccFSR16g, MPU9150AccHPFReset, MPU9150GyroFSR2000DPS ) ) {
+    /* 8kHz / ( 1 + 7 ) = 1kHz ( 8kHzはI2Cで読み切れない ) をFIFOにためてまとめて読む */
+    if ( mpu9150_init( &mpu9150, 0x68, 7, MPU9150LPFCFG0, MPU9150AccFSR16g, MPU9150AccHPFReset, MPU9150GyroFSR2000DPS )
+         && mpu9150_fifo_enable( &mpu9150 ) ) {
         enabled_dev |= DEV_GYRO | DEV_ACC | DEV_TEMP;
     }
 
-    if ( ak8975_init( &mag, 0x0C ) ) {
+    /* 地磁気はMPU9150の補助I2C経由 ( 加速度・ジャイロと同じフレームで 1kHz / ( 1 + 9 ) = 100Hz ) */
+    if ( ( enabled_dev & DEV_ACC ) && ak8975_init( &mag, 0x0C ) && ak8975_aux_enable( &mag, &mpu9150, MAG_AUX_DELAY ) ) {
         enabled_dev |= DEV_MAG;
     }
 
-    if ( lps25h_init( &pres, 0x5D, LPS25H25_25Hz, LPS25HPresAvg512, LPS25HTempAvg64 ) ) {
-        enabled_dev |= DEV_PRESS;
+    /* 気圧・温度はFIFOにためてまとめて読む */
+    if ( lps25h_init( &pres, 0x5D, LPS25H25_25Hz, LPS25HPresAvg512, LPS25HTempAvg64 )
+         && lps25h_fifo_enable( &pres, LPS25H_FIFO_BURST ) ) {
+        enabled_dev |= DEV_PRESS | DEV_PRESS_TEMP;
+    }
+
+#ifdef SENSOR_INT
+    /* ウォーターマークをINT1に出す */
+    if ( ( enabled_dev & DEV_PRESS ) && !lps25h_int_enable( &pres, LPS25HIntWatermark ) ) {
+        enabled_dev &= ~( DEV_PRESS | DEV_PRESS_TEMP );
     }
+#endif
 
     /* LEDを消して少し待つ */
     PORTD &= ~LED_STATUS;
@@ -227,10 +665,22 @@ int main( void )
 
     /* 測定開始 */
     lps25h_start( &pres );
-    ak8975_start( &mag );
+
+    /* 読み込み予定 ( 各センサーの設定したサンプルレートから ) */
+    sensor_poll_init( &sensor, &pres, &mpu9150, &mag, SENSOR_USE_INT );
+
+    /* プレビューの間引き ( 既定はIMUと地磁気10Hz，気圧と温度1Hz ) */
+    decimate_init( &previews[PreviewPres], &preview_sums[0], 1, 4, preview_ratio( PREVIEW_PRES_PERIOD, pres.sample_period ) );
+    decimate_init( &previews[PreviewPresTemp], &preview_sums[1], 1, 2, preview_ratio( PREVIEW_PRES_PERIOD, pres.sample_period ) );
+    decimate_init( &previews[PreviewIMU], &preview_sums[2], 7, 2, preview_ratio( PREVIEW_IMU_PERIOD, mpu9150.sample_period ) );
+    decimate_init( &previews[PreviewMag], &preview_sums[9], 3, 2,
+                   preview_ratio( PREVIEW_IMU_PERIOD, mpu9150.sample_period * ( 1 + MAG_AUX_DELAY ) ) );
 
     /* 各種変数初期化 */
     write_dev     = 0;
+    frame_init( &usart_frame );
+    log_sink_init( &sinks[SinkSD], sd_sink_write, sd_sink_process, &stage );
+    log_sink_init( &sinks[SinkUSART], usart_sink_write, NULL, NULL );
     before_system_clock = 0;
     now_system_clock    = 0;
     system_clock        = 0;
@@ -262,19 +712,26 @@ int main( void )
 
                 if ( SW_START_STOP & now_input ) {
                     /* スタートストップボタン */
-                    if ( write_dev && target == WriteToSD ) {
-                        /* 書き込み中なら書き込み停止 */
+                    if ( sinks[SinkSD].active ) {
+                        /* 書き込み中なら書き込み停止 ( 残りは落とさないように待って書く ) */
+                        sinks[SinkSD].policy = LogSinkWait;
+#ifdef LOG_PACK
+
+                        /* 途中までのIMUブロック */
+                        record_write_pack();
+#endif
 
                         /* 終了シグネチャ書き込み */
-                        data = LOG_END_SIGNATURE;
-                        micomfs_seq_fwrite( &fp, &data, 1 );
+                        end = LOG_END_SIGNATURE;
+                        log_sink_write( &sinks[SinkSD], &end, 1 );
+                        log_sink_stop( &sinks[SinkSD] );
 
                         /* Stop file writing */
-                        ret  = micomfs_stop_fwrite( &fp, 0 );
+                        ret  = sd_stage_stop( &stage, 0 );
                         ret += micomfs_fclose( &fp );
 
-                        /* 書き込み指示クリア */
-                        write_dev = 0;
+                        /* 書き込み指示クリア ( USARTへ送信中なら測定は続ける ) */
+                        log_update_devices();
 
                         /* 確認 */
                         if ( ret ) {
@@ -284,8 +741,8 @@ int main( void )
                             /* 失敗したので停止 */
                             fatal_error();
                         }
-                    } else if ( !write_dev ) {
-                        /* 書き込み中でなければ書き込み開始 */
+                    } else {
+                        /* 書き込み中でなければ書き込み開始 ( USARTへ送信中でも同時に ) */
 
                         /* 開始するたびにFS初期化とファイル作成 */
                         ret = micomfs_init_fs( &fs );
@@ -301,22 +758,12 @@ int main( void )
                             /* ファイルの確保失敗 */
                             fatal_error();
                         } else {
-                            /* 有効デバイスリスト作成 */
-                            write_dev = enabled_dev & all_sensors;
-
-                            // Write to SD
-                            target = WriteToSD;
-
-                            /* 書き込み開始 */
-                            micomfs_start_fwrite( &fp, 0 );
+                            /* 書き込み開始 ( ヘッダーは次のループで書く ) */
+                            sd_stage_start( &stage, &fp );
+                            log_sink_start( &sinks[SinkSD], LogSinkDrop );
 
-                            /* シグネチャ書き込み */
-                            data = DEVICE_LOG_SIGNATURE;
-                            micomfs_seq_fwrite( &fp, &data, 1 );
-
-                            /* 有効デバイスリスト書き込み */
-                            data = write_dev;
-                            micomfs_seq_fwrite( &fp, &data, 1 );
+                            /* 有効デバイスリスト作成 */
+                            log_update_devices();
 
                             /* 光る */
                             PORTD |= LED_STATUS;
@@ -349,11 +796,22 @@ int main( void )
         now_system_clock = system_clock;
         sei();
 
+        /* I2Cキューが時間切れならバス復旧 */
+        i2c_poll();
+
+        /* USARTへの送信の開始・停止，フレームの送信，ハンドシェイクとボーレート変更の応答 */
+        usart_link_process( now_system_clock );
+
         /* 書き込み中でなければ測定しない */
         if ( !write_dev ) {
             continue;
         }
 
+        /* SDへの書き込みを進める ( 1回で少しずつ ) */
+        if ( sinks[SinkSD].active ) {
+            sd_stage_process( &stage );
+        }
+
         /* ピコピコして動いていることを示す */
         /*
         if ( now_system_clock & 0x400 ) {
@@ -368,179 +826,86 @@ int main( void )
             PORTD |= LED_STATUS;
         }
 
-        /* センサー情報取得 */
-        updated_dev = 0;
+        /* センサー情報取得 ( 読み込みはTWI割り込みで進むので，終わったものだけ処理して次を頼む ) */
+        updated_dev = sensor_poll( &sensor, enabled_dev, now_system_clock, PRESS_INT_LEVEL() );
 
-        if ( ( enabled_dev & DEV_PRESS ) && lps25h_data_ready( &pres ) ) {
-            /* 気圧 */
-            lps25h_read( &pres );
-
-            updated_dev |= DEV_PRESS;
+        /* 始めた書き込み先にはファイルヘッダー ( シグネチャ, 有効デバイス ) */
+        for ( i = 0; i < SinkCount; i++ ) {
+            if ( sinks[i].active && sinks[i].need_header ) {
+#ifdef LOG_PACK
+                if ( i == SinkSD ) {
+                    imu_pack_init( &imu_pack );
+                }
+#endif
+                log_sink_header( &sinks[i], write_dev );
+            }
         }
 
-        if ( ( enabled_dev & DEV_MAG ) && ak8975_data_ready( &mag ) ) {
-            /* 地磁気 */
-            ak8975_read( &mag );
-
-            /* 地磁気補正 */
-            ak8975_calc_adjusted_h( &mag );
-
-            /* 測定開始 */
-            ak8975_start( &mag );
-
-            updated_dev |= DEV_MAG;
+        /* 途中から読めるように1秒ごと ( とヘッダーの後，レコードを落とした後 ) に時刻同期 ( 間隔も落としたかも書き込み先ごと ) */
+        for ( i = 0; i < SinkCount; i++ ) {
+            if ( log_sink_sync_due( &sinks[i], now_system_clock, LOG_SYNC_INTERVAL ) ) {
+                log_sync( i, now_system_clock );
+            }
         }
 
-        if ( ( enabled_dev & ( DEV_ACC | DEV_GYRO ) ) && mpu9150_data_ready( &mpu9150 ) ) {
-            /* 加速度・温度・ジャイロ */
-            mpu9150_read( &mpu9150 );
-
-            updated_dev |= ( DEV_ACC | DEV_GYRO | DEV_TEMP );
-        }
+        /* 必要なら各センサーデータ処理と書き込み ( 1レコードの中身を1回作って書き込み先ごとに1回で書く ) */
+        data = record + LOG_SINK_HEADER_MAX;
 
-        /* 必要なら各センサーデータ処理と書き込み */
         if ( ( write_dev & DEV_PRESS ) && ( updated_dev & DEV_PRESS ) ) {
             /* 気圧書き込み */
-            if ( target == WriteToSD ) {
-                data = LOG_SIGNATURE;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &now_system_clock, sizeof( now_system_clock ) );
-                data = ID_LPS331AP;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                data = sizeof( pres.pressure );
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &pres.pressure, sizeof( pres.pressure ) );
-            } else if ( target == WriteToUSART ) {
-                while ( !usart_can_write() ); usart_write( LOG_SIGNATURE );
-                for ( i = 0; i < sizeof( now_system_clock ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&now_system_clock )[i] );
-                }
-                while ( !usart_can_write() ); usart_write( ID_LPS331AP );
-                while ( !usart_can_write() ); usart_write( sizeof( pres.pressure ) );
-                for ( i = 0; i < sizeof( pres.pressure ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&pres.pressure )[i] );
-                }
-            }
+            p = record_put32( data, pres.pressure );
+            record_write( data, p - data, sensor.pres_clock, ID_LPS331AP, SINK_ALL );
         }
 
-        if ( ( write_dev & DEV_ACC ) && ( updated_dev & DEV_ACC ) ) {
-            /* 加速度書き込み */
-            if ( target == WriteToSD ) {
-                data = LOG_SIGNATURE;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &now_system_clock, sizeof( now_system_clock ) );
-                data = ID_MPU9150_ACC;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                data = sizeof( mpu9150.acc_x ) * 3;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &mpu9150.acc_x, sizeof( mpu9150.acc_x ) );
-                micomfs_seq_fwrite( &fp, &mpu9150.acc_y, sizeof( mpu9150.acc_y ) );
-                micomfs_seq_fwrite( &fp, &mpu9150.acc_z, sizeof( mpu9150.acc_z ) );
-            } else if ( target == WriteToUSART ) {
-                while ( !usart_can_write() ); usart_write( LOG_SIGNATURE );
-                for ( i = 0; i < sizeof( now_system_clock ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&now_system_clock )[i] );
-                }
-                while ( !usart_can_write() ); usart_write( ID_MPU9150_ACC );
-                while ( !usart_can_write() ); usart_write( sizeof( mpu9150.acc_x ) * 3 );
-                for ( i = 0; i < sizeof( mpu9150.acc_x ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.acc_x )[i] );
-                }
-                for ( i = 0; i < sizeof( mpu9150.acc_y ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.acc_y )[i] );
-                }
-                for ( i = 0; i < sizeof( mpu9150.acc_z ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.acc_z )[i] );
-                }
-            }
+        if ( ( write_dev & DEV_PRESS_TEMP ) && ( updated_dev & DEV_PRESS_TEMP ) ) {
+            /* 気圧センサー温度書き込み */
+            p = record_put16( data, pres.temp );
+            record_write( data, p - data, sensor.pres_clock, ID_LPS331AP_TEMP, SINK_ALL );
         }
 
-        if ( ( write_dev & DEV_GYRO ) && ( updated_dev & DEV_GYRO ) ) {
-            /* ジャイロ書き込み */
-            if ( target == WriteToSD ) {
-                data = LOG_SIGNATURE;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &now_system_clock, sizeof( now_system_clock ) );
-                data = ID_MPU9150_GYRO;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                data = sizeof( mpu9150.gyro_x ) * 3;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &mpu9150.gyro_x, sizeof( mpu9150.gyro_x ) );
-                micomfs_seq_fwrite( &fp, &mpu9150.gyro_y, sizeof( mpu9150.gyro_y ) );
-                micomfs_seq_fwrite( &fp, &mpu9150.gyro_z, sizeof( mpu9150.gyro_z ) );
-            } else if ( target == WriteToUSART ) {
-                while ( !usart_can_write() ); usart_write( LOG_SIGNATURE );
-                for ( i = 0; i < sizeof( now_system_clock ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&now_system_clock )[i] );
-                }
-                while ( !usart_can_write() ); usart_write( ID_MPU9150_GYRO );
-                while ( !usart_can_write() ); usart_write( sizeof( mpu9150.gyro_x ) * 3 );
-                for ( i = 0; i < sizeof( mpu9150.gyro_x ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.gyro_x )[i] );
-                }
-                for ( i = 0; i < sizeof( mpu9150.gyro_y ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.gyro_y )[i] );
+        if ( ( write_dev & ( DEV_ACC | DEV_GYRO | DEV_TEMP ) ) && ( updated_dev & DEV_ACC ) ) {
+            /* 加速度・ジャイロ・温度は同じフレームなので1レコードで書き込み */
+            mask = SINK_ALL;
+
+#ifdef LOG_PACK
+            /* SDにはIMU_PACK_FRAMESフレームたまったら圧縮して書き込み ( 圧縮したレコードはUSARTのフレームに入らない ) */
+            if ( sinks[SinkSD].active ) {
+                frame[0] = mpu9150.acc_x;
+                frame[1] = mpu9150.acc_y;
+                frame[2] = mpu9150.acc_z;
+                frame[3] = mpu9150.gyro_x;
+                frame[4] = mpu9150.gyro_y;
+                frame[5] = mpu9150.gyro_z;
+                frame[6] = mpu9150.temp;
+
+                if ( !imu_pack_regular( &imu_pack, sensor.mpu_clock ) ) {
+                    record_write_pack();
                 }
-                for ( i = 0; i < sizeof( mpu9150.gyro_z ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.gyro_z )[i] );
+
+                if ( imu_pack_add( &imu_pack, sensor.mpu_clock, frame ) ) {
+                    record_write_pack();
                 }
+
+                mask &= ~_BV( SinkSD );
             }
+#endif
+
+            p = record_put16( data, mpu9150.acc_x );
+            p = record_put16( p, mpu9150.acc_y );
+            p = record_put16( p, mpu9150.acc_z );
+            p = record_put16( p, mpu9150.gyro_x );
+            p = record_put16( p, mpu9150.gyro_y );
+            p = record_put16( p, mpu9150.gyro_z );
+            p = record_put16( p, mpu9150.temp );
+            record_write( data, p - data, sensor.mpu_clock, ID_MPU9150_IMU, mask );
         }
 
         if ( ( write_dev & DEV_MAG ) && ( updated_dev & DEV_MAG ) ) {
             /* 地磁気書き込み */
-            if ( target == WriteToSD ) {
-                data = LOG_SIGNATURE;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &now_system_clock, sizeof( now_system_clock ) );
-                data = ID_AK8975;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                data = sizeof( mag.adj_x ) * 3;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &mag.adj_x, sizeof( mag.adj_x ) );
-                micomfs_seq_fwrite( &fp, &mag.adj_y, sizeof( mag.adj_y ) );
-                micomfs_seq_fwrite( &fp, &mag.adj_z, sizeof( mag.adj_z ) );
-            } else if ( target == WriteToUSART ) {
-                while ( !usart_can_write() ); usart_write( LOG_SIGNATURE );
-                for ( i = 0; i < sizeof( now_system_clock ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&now_system_clock )[i] );
-                }
-                while ( !usart_can_write() ); usart_write( ID_AK8975 );
-                while ( !usart_can_write() ); usart_write( sizeof( mag.adj_x ) * 3 );
-                for ( i = 0; i < sizeof( mag.adj_x ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mag.adj_x )[i] );
-                }
-                for ( i = 0; i < sizeof( mag.adj_y ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mag.adj_y )[i] );
-                }
-                for ( i = 0; i < sizeof( mag.adj_z ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mag.adj_z )[i] );
-                }
-            }
-        }
-
-        if ( ( write_dev & DEV_TEMP ) && ( updated_dev & DEV_TEMP ) ) {
-            /* 温度書き込み */
-            if ( target == WriteToSD ) {
-                data = LOG_SIGNATURE;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &now_system_clock, sizeof( now_system_clock ) );
-                data = ID_MPU9150_TEMP;
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                data = sizeof( mpu9150.temp );
-                micomfs_seq_fwrite( &fp, &data, 1 );
-                micomfs_seq_fwrite( &fp, &mpu9150.temp, sizeof( mpu9150.temp ) );
-            } else if ( target == WriteToUSART ) {
-                while ( !usart_can_write() ); usart_write( LOG_SIGNATURE );
-                for ( i = 0; i < sizeof( now_system_clock ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&now_system_clock )[i] );
-                }
-                while ( !usart_can_write() ); usart_write( ID_MPU9150_TEMP );
-                while ( !usart_can_write() ); usart_write( sizeof( mpu9150.temp ) );
-                for ( i = 0; i < sizeof( mpu9150.temp ); i++ ) {
-                    while ( !usart_can_write() ); usart_write( ( (uint8_t *)&mpu9150.temp )[i] );
-                }
-            }
+            p = record_put16( data, mag.adj_x );
+            p = record_put16( p, mag.adj_y );
+            p = record_put16( p, mag.adj_z );
+            record_write( data, p - data, sensor.mpu_clock, ID_AK8975, SINK_ALL );
         }
     }
 
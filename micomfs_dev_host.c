@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "micomfs_dev_host.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+/* 開いているデバイスごとの情報 */
+typedef struct {
+    int fd;
+    uint8_t buf[MICOMFS_DEV_HOST_SECTOR_SIZE];
+} MicomFSHostDevice;
+
+char micomfs_dev_get_info( MicomFS *fs, uint16_t *sector_size, uint32_t *sector_count )
+{
+    /* ファイルシステムに必要な情報を返す */
+    MicomFSHostDevice *dev = fs->device;
+    struct stat st;
+    uint64_t size;
+
+    if ( dev == NULL || fstat( dev->fd, &st ) < 0 ) {
+        return 0;
+    }
+
+    /* ブロックデバイスはst_sizeが0なのでioctlで取得 */
+    if ( S_ISBLK( st.st_mode ) ) {
+        if ( ioctl( dev->fd, BLKGETSIZE64, &size ) < 0 ) {
+            return 0;
+        }
+    } else {
+        size = st.st_size;
+    }
+
+    *sector_size  = MICOMFS_DEV_HOST_SECTOR_SIZE;
+    *sector_count = size / MICOMFS_DEV_HOST_SECTOR_SIZE;
+
+    return 1;
+}
+
+char micomfs_dev_open( MicomFS *fs, const char *dev_name, MicomFSDeviceType dev_type, MicomFSDeviceMode dev_mode )
+{
+    /* デバイスを開く */
+    MicomFSHostDevice *dev;
+    int flags;
+
+    /* 書き込みでもエントリーを読むので読み書き両方で開く */
+    if ( dev_mode == MicomFSDeviceModeRead ) {
+        flags = O_RDONLY;
+    } else {
+        flags = O_RDWR | O_CREAT;
+    }
+
+    dev = malloc( sizeof( MicomFSHostDevice ) );
+
+    if ( dev == NULL ) {
+        return 0;
+    }
+
+    dev->fd = open( dev_name, flags, 0644 );
+
+    if ( dev->fd < 0 ) {
+        free( dev );
+        return 0;
+    }
+
+    fs->device   = dev;
+    fs->dev_name = strdup( dev_name );
+    fs->dev_type = ( dev_type == MicomFSDeviceAuto ) ? MicomFSDeviceFile : dev_type;
+    fs->dev_current_sector = 0;
+    fs->dev_current_spos   = 0;
+
+    return 1;
+}
+
+char micomfs_dev_close( MicomFS *fs )
+{
+    /* デバイスを閉じる */
+    MicomFSHostDevice *dev = fs->device;
+    int ret;
+
+    if ( dev == NULL ) {
+        return 0;
+    }
+
+    ret = close( dev->fd );
+
+    free( dev );
+    free( fs->dev_name );
+    fs->device   = NULL;
+    fs->dev_name = NULL;
+
+    return ( ret == 0 );
+}
+
+int micomfs_dev_host_fd( MicomFS *fs )
+{
+    /* 生のファイルディスクリプター */
+    MicomFSHostDevice *dev = fs->device;
+
+    if ( dev == NULL ) {
+        return -1;
+    }
+
+    return dev->fd;
+}
+
+char micomfs_dev_start_write( MicomFS *fs, uint32_t sector )
+{
+    /* セクターライト開始 ( stopまでバッファーにためる ) */
+    MicomFSHostDevice *dev = fs->device;
+
+    memset( dev->buf, 0, sizeof( dev->buf ) );
+
+    fs->dev_current_sector = sector;
+    fs->dev_current_spos   = 0;
+
+    return 1;
+}
+
+char micomfs_dev_write( MicomFS *fs, const void *src, uint16_t count )
+{
+    /* バッファーに書き込み */
+    MicomFSHostDevice *dev = fs->device;
+
+    if ( fs->dev_current_spos + count > MICOMFS_DEV_HOST_SECTOR_SIZE ) {
+        return 0;
+    }
+
+    memcpy( dev->buf + fs->dev_current_spos, src, count );
+    fs->dev_current_spos += count;
+
+    return 1;
+}
+
+char micomfs_dev_stop_write( MicomFS *fs )
+{
+    /* セクターライト終了 */
+    MicomFSHostDevice *dev = fs->device;
+    off_t offset = (off_t)fs->dev_current_sector * MICOMFS_DEV_HOST_SECTOR_SIZE;
+
+    if ( pwrite( dev->fd, dev->buf, MICOMFS_DEV_HOST_SECTOR_SIZE, offset ) != MICOMFS_DEV_HOST_SECTOR_SIZE ) {
+        return 0;
+    }
+
+    return 1;
+}
+
+char micomfs_dev_start_read( MicomFS *fs, uint32_t sector )
+{
+    /* セクターリード開始 ( 1セクター丸ごと読んでおく ) */
+    MicomFSHostDevice *dev = fs->device;
+    off_t offset = (off_t)sector * MICOMFS_DEV_HOST_SECTOR_SIZE;
+
+    fs->dev_current_sector = sector;
+    fs->dev_current_spos   = 0;
+
+    if ( pread( dev->fd, dev->buf, MICOMFS_DEV_HOST_SECTOR_SIZE, offset ) != MICOMFS_DEV_HOST_SECTOR_SIZE ) {
+        return 0;
+    }
+
+    return 1;
+}
+
+char micomfs_dev_read( MicomFS *fs, void *dest, uint16_t count )
+{
+    /* バッファーから読み込み */
+    MicomFSHostDevice *dev = fs->device;
+
+    /* セクターを超える読み込みは0で埋めて失敗 ( 壊れたエントリー名で止まるように ) */
+    if ( fs->dev_current_spos + count > MICOMFS_DEV_HOST_SECTOR_SIZE ) {
+        memset( dest, 0, count );
+        return 0;
+    }
+
+    memcpy( dest, dev->buf + fs->dev_current_spos, count );
+    fs->dev_current_spos += count;
+
+    return 1;
+}
+
+char micomfs_dev_stop_read( MicomFS *fs )
+{
+    /* セクターリード終了 */
+    return 1;
+}
@@ -0,0 +1,31 @@
+/*
+ * micomfs PC用デバイスモジュール
+ *
+ * micomfs_dev.cのSD版の代わりにリンクすると，イメージファイルやブロックデバイス( /dev/sdX など )を
+ * pread/pwriteでセクター単位に読み書きします．
+ * セクターサイズはSDと同じ512固定です．
+ *
+ * micomfs_dev_host_fdで生のファイルディスクリプターを取得できるので，
+ * ファイルの中身はセクター単位のAPIを通さずにカーネル内でコピーできます．
+ *
+ */
+
+#ifndef MICOMFS_DEV_HOST_H_INCLUDED
+#define MICOMFS_DEV_HOST_H_INCLUDED
+
+#include "micomfs.h"
+#include "micomfs_dev.h"
+
+#define MICOMFS_DEV_HOST_SECTOR_SIZE 512
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int micomfs_dev_host_fd( MicomFS *fs );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
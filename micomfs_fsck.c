@@ -0,0 +1,928 @@
+/*
+ * micomfs PC用イメージ検査ツール
+ *
+ * micomfs_fsck [-j THREADS] [-q] IMAGE
+ *
+ * 1. micomfs_formatで書かれた先頭セクターを確認
+ * 2. エントリーの開始セクター・セクター数がmicomfs_fcreateの前提通り，
+ *    先頭から順番に重ならずに並んでいるか確認
+ * 3. 各ログファイルのレコード構造 ( シグネチャ，デバイスID，サイズ，時刻の単調増加，終了シグネチャ ) を確認
+ *    v2のログは時刻同期からしか時刻がわからないので，時刻の確認は同期の後のIDごとと，同期の時刻どうしです．
+ *
+ * 3はファイルをCHUNK_SIZEごとに分けて全コアで並列に読みます．
+ * チャンクの境目はレコードの途中なので，各チャンクは先頭から最初の確からしいレコードを探して ( 再同期 ) 読み始め，
+ * 最後に前のチャンクが読み終えた位置と次のチャンクが読み始めた位置が一致するかを順番に確認します．
+ * 一致しなかったチャンクだけは前のチャンクの終わりから読み直します．
+ *
+ * 今のログ形式にはCRCがないので，中身の検査はレコードの枠組みだけです．
+ *
+ */
+
+#define _GNU_SOURCE
+#include "micomfs.h"
+#include "micomfs_dev_host.h"
+#include "device_id.h"
+#include "sensor_log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE       ( 4UL * 1024 * 1024 )
+#define READ_WINDOW_SIZE ( 256UL * 1024 )
+#define RECORD_HEADER_SIZE 7    /* シグネチャ + 時刻4 + ID + サイズ */
+#define LOG_HEADER_SIZE    2    /* DEVICE_LOG_SIGNATURE + 有効デバイス */
+#define V2_SYNC_CHAIN      4    /* v2で区切りとみなすのに続けて読めるべき項目数 */
+#define MAX_THREADS 256
+
+/* エントリー名はuint8_tで数えられるので256あれば溢れない */
+typedef struct {
+    uint16_t id;
+    uint8_t  flag;
+    uint32_t start_sector;
+    uint32_t sector_count;
+    uint8_t  version;           /* ログ形式 ( 1か2 ) */
+    char name[256];
+} FsckEntry;
+
+/* 並列で検査する単位 */
+typedef struct {
+    FsckEntry *entry;
+    uint64_t begin;             /* ファイル内のバイト位置 */
+    uint64_t end;
+    uint32_t index;             /* ファイル内で何番目のチャンクか */
+
+    /* 結果 */
+    char synced;                /* レコードの区切りを見つけられた */
+    char exit_known;            /* 最後のレコードの終わりがわかっている */
+    char ended;                 /* 終了シグネチャを見つけた */
+    char all_zero;              /* 全部0 ( 終了後の埋め ) */
+    uint64_t sync_offset;       /* 最初のレコードの位置 */
+    uint64_t exit_offset;       /* endをまたいだ最後のレコードの終わり */
+    uint64_t records;
+    char clock_known;           /* first_clock / last_clock がわかっている */
+    uint32_t first_clock;
+    uint32_t last_clock;
+    uint32_t errors;
+    char first_error[160];
+} FsckChunk;
+
+/* スレッドごとの読み込み窓 */
+typedef struct {
+    int fd;
+    off_t base;
+    uint64_t length;
+    uint8_t version;
+    uint8_t buf[READ_WINDOW_SIZE];
+    uint64_t buf_pos;
+    size_t buf_len;
+} FsckReader;
+
+/* スレッド間で共有するもの */
+typedef struct {
+    int fd;
+    uint16_t sector_size;
+    FsckChunk *chunks;
+    uint32_t chunk_count;
+    uint32_t next;
+    pthread_mutex_t lock;
+} FsckWork;
+
+static int problems;
+static int quiet;
+
+static void report( const char *fmt, ... )
+{
+    /* 問題を表示 */
+    va_list ap;
+
+    problems++;
+
+    va_start( ap, fmt );
+    vprintf( fmt, ap );
+    va_end( ap );
+    putchar( '\n' );
+}
+
+static int reader_byte( FsckReader *r, uint64_t pos )
+{
+    /* ファイル内のposのバイト ( 範囲外か読めなければ-1 ) */
+    ssize_t n;
+
+    if ( pos >= r->length ) {
+        return -1;
+    }
+
+    if ( pos < r->buf_pos || pos >= r->buf_pos + r->buf_len ) {
+        r->buf_pos = pos;
+        r->buf_len = ( r->length - pos < READ_WINDOW_SIZE ) ? r->length - pos : READ_WINDOW_SIZE;
+
+        n = pread( r->fd, r->buf, r->buf_len, r->base + pos );
+
+        if ( n <= 0 ) {
+            r->buf_len = 0;
+            return -1;
+        }
+
+        r->buf_len = n;
+    }
+
+    return r->buf[pos - r->buf_pos];
+}
+
+static uint32_t reader_clock( FsckReader *r, uint64_t pos )
+{
+    /* リトルエンディアンの時刻 */
+    return (uint32_t)reader_byte( r, pos ) |
+           (uint32_t)reader_byte( r, pos + 1 ) << 8 |
+           (uint32_t)reader_byte( r, pos + 2 ) << 16 |
+           (uint32_t)reader_byte( r, pos + 3 ) << 24;
+}
+
+static uint8_t reader_delta( FsckReader *r, uint64_t pos, int32_t *delta )
+{
+    /* v2の時刻の差 ( 使ったバイト数，壊れていれば0 ) */
+    uint8_t buf[SENSOR_LOG_VARINT_MAX];
+    int c, i;
+
+    for ( i = 0; i < SENSOR_LOG_VARINT_MAX; i++ ) {
+        if ( ( c = reader_byte( r, pos + i ) ) < 0 ) {
+            return 0;
+        }
+
+        buf[i] = c;
+
+        if ( !( c & 0x80 ) ) {
+            break;
+        }
+    }
+
+    return sensor_log_decode_delta( buf, SENSOR_LOG_VARINT_MAX, delta );
+}
+
+static int item_size_v2( FsckReader *r, uint64_t pos )
+{
+    /* posのv2の項目 ( 時刻同期かレコード ) の長さ ( 違えば0 ) */
+    int sig, id, n, size;
+    int32_t delta;
+
+    sig = reader_byte( r, pos );
+
+    if ( sig == LOG_V2_SYNC ) {
+        return LOG_V2_SYNC_SIZE;
+    }
+
+    if ( sig < 0 || ( sig & 0xF0 ) != LOG_V2_RECORD ) {
+        return 0;
+    }
+
+    id = sig & 0x0F;
+
+    if ( id >= DEVICE_COUNT || sensor_log_size( id ) == 0 ) {
+        return 0;
+    }
+
+    if ( ( n = reader_delta( r, pos + 1, &delta ) ) == 0 ) {
+        return 0;
+    }
+
+    /* サイズ付きのレコード ( 圧縮したIMUブロック ) */
+    if ( sensor_log_size( id ) == SENSOR_LOG_SIZE_VARIABLE ) {
+        size = reader_byte( r, pos + 1 + n );
+
+        return ( size > 0 ) ? 1 + n + 1 + size : 0;
+    }
+
+    return 1 + n + sensor_log_size( id );
+}
+
+static char record_at_v2( FsckReader *r, uint64_t pos )
+{
+    /* v2は1バイトのシグネチャしかないので，何項目か続けて読めたら区切りとみなす */
+    int size, i;
+
+    for ( i = 0; i < V2_SYNC_CHAIN; i++ ) {
+        if ( i > 0 && reader_byte( r, pos ) == LOG_END_SIGNATURE ) {
+            return 1;
+        }
+
+        if ( ( size = item_size_v2( r, pos ) ) == 0 ) {
+            return 0;
+        }
+
+        pos += size;
+    }
+
+    return 1;
+}
+
+static char record_at( FsckReader *r, uint64_t pos )
+{
+    /* posが確からしいレコードの先頭か ( サイズのわかるIDで，次もレコードか終了 ) */
+    int id, size, next;
+
+    if ( r->version == 2 ) {
+        return record_at_v2( r, pos );
+    }
+
+    if ( reader_byte( r, pos ) != LOG_SIGNATURE ) {
+        return 0;
+    }
+
+    id   = reader_byte( r, pos + 5 );
+    size = reader_byte( r, pos + 6 );
+
+    if ( id < 0 || id >= DEVICE_COUNT || sensor_log_size( id ) == 0 || sensor_log_size( id ) != size ) {
+        return 0;
+    }
+
+    next = reader_byte( r, pos + RECORD_HEADER_SIZE + size );
+
+    return ( next == LOG_SIGNATURE || next == LOG_END_SIGNATURE );
+}
+
+static char resync( FsckReader *r, uint64_t *pos, uint64_t stop )
+{
+    /* stopまでに次のレコードを探す */
+    for ( ; *pos < stop; ( *pos )++ ) {
+        if ( record_at( r, *pos ) ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void chunk_error( FsckChunk *c, uint64_t pos, const char *what )
+{
+    /* チャンク内のエラーを記録 ( 最初の一つだけ文章で残す ) */
+    if ( c->errors == 0 ) {
+        snprintf( c->first_error, sizeof( c->first_error ), "%s at byte %llu", what, (unsigned long long)pos );
+    }
+
+    c->errors++;
+}
+
+static void chunk_end( FsckReader *r, FsckChunk *c, uint64_t pos )
+{
+    /* 終了シグネチャ．残りは0埋めのはず */
+    uint64_t i;
+
+    c->ended = 1;
+    c->exit_known = 1;
+    c->exit_offset = pos + 1;
+
+    for ( i = pos + 1; i < c->end; i++ ) {
+        if ( reader_byte( r, i ) != 0 ) {
+            chunk_error( c, i, "data after end signature" );
+            break;
+        }
+    }
+}
+
+static void parse_chunk_v2( FsckReader *r, FsckChunk *c, uint64_t pos )
+{
+    /* v2の項目を時刻同期から時刻を追いながらendをまたぐ項目まで検査する */
+    uint32_t base[DEVICE_COUNT];
+    uint32_t last[DEVICE_COUNT];
+    char seen[DEVICE_COUNT];
+    char have_sync = 0;
+    uint32_t clock;
+    int32_t delta;
+    int sig, id, size, i;
+
+    memset( seen, 0, sizeof( seen ) );
+
+    while ( pos < c->end ) {
+        sig = reader_byte( r, pos );
+
+        if ( sig == LOG_END_SIGNATURE ) {
+            chunk_end( r, c, pos );
+            return;
+        }
+
+        if ( sig < 0 ) {
+            chunk_error( c, pos, "read error" );
+            return;
+        }
+
+        size = item_size_v2( r, pos );
+
+        if ( size == 0 ) {
+            chunk_error( c, pos, ( ( sig & 0xF0 ) == LOG_V2_RECORD ) ? "bad device id or delta" : "bad record signature" );
+
+            /* 次の項目まで飛ばす．次の時刻同期まで時刻はわからない */
+            pos++;
+
+            if ( !resync( r, &pos, c->end ) ) {
+                return;
+            }
+
+            have_sync = 0;
+            memset( seen, 0, sizeof( seen ) );
+            continue;
+        }
+
+        /* ファイル末尾をはみ出す項目 */
+        if ( pos + size > r->length ) {
+            chunk_error( c, pos, "truncated record" );
+            return;
+        }
+
+        if ( sig == LOG_V2_SYNC ) {
+            /* 同期の時刻は減らない */
+            clock = reader_clock( r, pos + 1 );
+
+            if ( !c->clock_known ) {
+                c->first_clock = clock;
+                c->clock_known = 1;
+            } else if ( clock < c->last_clock ) {
+                chunk_error( c, pos, "sync timestamp went backwards" );
+            }
+
+            c->last_clock = clock;
+
+            for ( i = 0; i < DEVICE_COUNT; i++ ) {
+                base[i] = clock;
+            }
+
+            have_sync = 1;
+        } else {
+            /* IDごとの時刻は減らない ( センサーが違えば前後する ) */
+            id = sig & 0x0F;
+
+            if ( have_sync ) {
+                reader_delta( r, pos + 1, &delta );
+                clock = base[id] += delta;
+
+                if ( seen[id] && clock < last[id] ) {
+                    chunk_error( c, pos, "timestamp went backwards" );
+                }
+
+                last[id] = clock;
+                seen[id] = 1;
+            }
+
+            c->records++;
+        }
+
+        pos += size;
+    }
+
+    c->exit_known = 1;
+    c->exit_offset = pos;
+}
+
+static void parse_chunk( FsckReader *r, FsckChunk *c, uint64_t pos, char known_boundary )
+{
+    /* posから読み始めてendをまたぐレコードまで検査する */
+    int sig, id, size;
+    uint32_t clock;
+    char have_clock = 0;
+    uint64_t i;
+
+    c->synced = 0;
+    c->exit_known = 0;
+    c->ended = 0;
+    c->all_zero = 0;
+    c->records = 0;
+    c->clock_known = 0;
+    c->errors = 0;
+    c->first_error[0] = '\0';
+
+    /* 区切りがわからなければ探す */
+    if ( !known_boundary && !resync( r, &pos, c->end ) ) {
+        /* 見つからない場合，全部0なら終了後の埋めとみなす */
+        c->all_zero = 1;
+
+        for ( i = c->begin; i < c->end; i++ ) {
+            if ( reader_byte( r, i ) != 0 ) {
+                c->all_zero = 0;
+                break;
+            }
+        }
+
+        return;
+    }
+
+    c->synced = 1;
+    c->sync_offset = pos;
+
+    if ( r->version == 2 ) {
+        parse_chunk_v2( r, c, pos );
+        return;
+    }
+
+    while ( pos < c->end ) {
+        sig = reader_byte( r, pos );
+
+        if ( sig == LOG_END_SIGNATURE ) {
+            chunk_end( r, c, pos );
+            return;
+        }
+
+        if ( sig < 0 ) {
+            chunk_error( c, pos, "read error" );
+            return;
+        }
+
+        id   = reader_byte( r, pos + 5 );
+        size = reader_byte( r, pos + 6 );
+
+        if ( sig != LOG_SIGNATURE || id < 0 || size < 0 || id >= DEVICE_COUNT ||
+             ( sensor_log_size( id ) && sensor_log_size( id ) != size ) ) {
+            chunk_error( c, pos, ( sig != LOG_SIGNATURE ) ? "bad record signature" : "bad device id or size" );
+
+            /* 次のレコードまで飛ばす */
+            pos++;
+
+            if ( !resync( r, &pos, c->end ) ) {
+                return;
+            }
+
+            have_clock = 0;
+            continue;
+        }
+
+        /* ファイル末尾をはみ出すレコード */
+        if ( pos + RECORD_HEADER_SIZE + size > r->length ) {
+            chunk_error( c, pos, "truncated record" );
+            return;
+        }
+
+        /* 時刻は減らない */
+        clock = reader_clock( r, pos + 1 );
+
+        if ( !c->clock_known ) {
+            c->first_clock = clock;
+            c->clock_known = 1;
+        } else if ( have_clock && clock < c->last_clock ) {
+            chunk_error( c, pos, "timestamp went backwards" );
+        }
+
+        c->last_clock = clock;
+        have_clock = 1;
+        c->records++;
+
+        pos += RECORD_HEADER_SIZE + size;
+    }
+
+    c->exit_known = 1;
+    c->exit_offset = pos;
+}
+
+static void reader_init( FsckReader *r, int fd, uint16_t sector_size, FsckEntry *entry )
+{
+    /* ファイル単位の読み込み窓を準備 */
+    r->fd = fd;
+    r->base = (off_t)entry->start_sector * sector_size;
+    r->length = (uint64_t)entry->sector_count * sector_size;
+    r->version = entry->version;
+    r->buf_pos = 0;
+    r->buf_len = 0;
+}
+
+static void *worker( void *arg )
+{
+    /* チャンクを一つずつ取って検査する */
+    FsckWork *work = arg;
+    FsckReader *reader;
+    FsckChunk *c;
+    uint32_t index;
+
+    reader = malloc( sizeof( FsckReader ) );
+
+    if ( reader == NULL ) {
+        return NULL;
+    }
+
+    while ( 1 ) {
+        pthread_mutex_lock( &work->lock );
+        index = work->next++;
+        pthread_mutex_unlock( &work->lock );
+
+        if ( index >= work->chunk_count ) {
+            break;
+        }
+
+        c = &work->chunks[index];
+        reader_init( reader, work->fd, work->sector_size, c->entry );
+
+        /* 先頭チャンクだけはヘッダーの直後が区切りだとわかっている */
+        if ( c->index == 0 ) {
+            parse_chunk( reader, c, LOG_HEADER_SIZE, 1 );
+        } else {
+            parse_chunk( reader, c, c->begin, 0 );
+        }
+    }
+
+    free( reader );
+
+    return NULL;
+}
+
+static char check_superblock( MicomFS *fs )
+{
+    /* 先頭セクターの確認 */
+    uint8_t signature;
+    uint16_t dev_sector_size;
+    uint32_t dev_sector_count;
+
+    if ( !micomfs_dev_get_info( fs, &dev_sector_size, &dev_sector_count ) ) {
+        report( "superblock: cannot get device size" );
+        return 0;
+    }
+
+    fs->dev_sector_size  = dev_sector_size;
+    fs->dev_sector_count = dev_sector_count;
+
+    if ( !micomfs_dev_start_read( fs, 0 ) ) {
+        report( "superblock: cannot read sector 0" );
+        return 0;
+    }
+
+    micomfs_dev_read( fs, &signature, 1 );
+    micomfs_dev_read( fs, &fs->sector_size, 2 );
+    micomfs_dev_read( fs, &fs->sector_count, 4 );
+    micomfs_dev_read( fs, &fs->entry_count, 2 );
+    micomfs_dev_read( fs, &fs->used_entry_count, 2 );
+    micomfs_dev_stop_read( fs );
+
+    if ( signature != MICOMFS_SIGNATURE ) {
+        report( "superblock: bad signature 0x%02X (expected 0x%02X)", signature, MICOMFS_SIGNATURE );
+        return 0;
+    }
+
+    if ( fs->sector_size != dev_sector_size ) {
+        report( "superblock: sector size %u does not match device sector size %u", fs->sector_size, dev_sector_size );
+        return 0;
+    }
+
+    if ( fs->sector_count > dev_sector_count ) {
+        report( "superblock: sector count %lu exceeds device size %lu sectors",
+                (unsigned long)fs->sector_count, (unsigned long)dev_sector_count );
+    }
+
+    if ( fs->entry_count == 0 || 1 + (uint32_t)fs->entry_count >= fs->sector_count ) {
+        report( "superblock: entry count %u does not fit in %lu sectors", fs->entry_count, (unsigned long)fs->sector_count );
+        return 0;
+    }
+
+    if ( fs->used_entry_count > fs->entry_count ) {
+        report( "superblock: used entry count %u exceeds entry count %u", fs->used_entry_count, fs->entry_count );
+        fs->used_entry_count = fs->entry_count;
+    }
+
+    if ( !quiet ) {
+        printf( "superblock: %lu sectors of %u bytes, %u/%u entries used\n",
+                (unsigned long)fs->sector_count, fs->sector_size, fs->used_entry_count, fs->entry_count );
+    }
+
+    return 1;
+}
+
+static char read_entry( MicomFS *fs, FsckEntry *entry, uint16_t id )
+{
+    /* エントリーをセクター内に収まる範囲で読む */
+    uint16_t i;
+    char terminated = 0;
+
+    entry->id = id;
+
+    if ( !micomfs_dev_start_read( fs, id + 1 ) ) {
+        report( "entry %u: cannot read sector %u", id, id + 1 );
+        return 0;
+    }
+
+    micomfs_dev_read( fs, &entry->flag, 1 );
+    micomfs_dev_read( fs, &entry->start_sector, 4 );
+    micomfs_dev_read( fs, &entry->sector_count, 4 );
+
+    for ( i = 0; i < sizeof( entry->name ) && 9 + i < fs->sector_size; i++ ) {
+        micomfs_dev_read( fs, &entry->name[i], 1 );
+
+        if ( entry->name[i] == '\0' ) {
+            terminated = 1;
+            break;
+        }
+    }
+
+    micomfs_dev_stop_read( fs );
+
+    if ( !terminated ) {
+        entry->name[sizeof( entry->name ) - 1] = '\0';
+        report( "entry %u: name is not terminated", id );
+    }
+
+    return 1;
+}
+
+static void check_entries( MicomFS *fs, FsckEntry *entries )
+{
+    /* エントリーの並びを確認 ( fcreateは前のファイルの直後に作る ) */
+    uint32_t expect = 1 + fs->entry_count;
+    FsckEntry *e;
+    uint16_t i;
+
+    for ( i = 0; i < fs->used_entry_count; i++ ) {
+        e = &entries[i];
+
+        if ( !read_entry( fs, e, i ) ) {
+            e->sector_count = 0;
+            continue;
+        }
+
+        if ( e->flag != MicomFSFileFlagNormal && e->flag != MicomFSFileFlagDeleted ) {
+            report( "entry %u (%s): unknown flag 0x%02X", i, e->name, e->flag );
+        }
+
+        if ( e->sector_count == 0 ) {
+            report( "entry %u (%s): zero sectors", i, e->name );
+        }
+
+        if ( e->start_sector < expect ) {
+            report( "entry %u (%s): starts at sector %lu, overlapping previous extent ending at %lu",
+                    i, e->name, (unsigned long)e->start_sector, (unsigned long)expect );
+        } else if ( e->start_sector > expect ) {
+            report( "entry %u (%s): gap of %lu sectors before start sector %lu",
+                    i, e->name, (unsigned long)( e->start_sector - expect ), (unsigned long)e->start_sector );
+        }
+
+        if ( e->start_sector >= fs->sector_count || e->sector_count > fs->sector_count - e->start_sector ) {
+            report( "entry %u (%s): extent %lu+%lu runs past end of file system (%lu sectors)",
+                    i, e->name, (unsigned long)e->start_sector, (unsigned long)e->sector_count,
+                    (unsigned long)fs->sector_count );
+
+            /* 中身の検査はデバイス内だけ */
+            if ( e->start_sector >= fs->sector_count ) {
+                e->sector_count = 0;
+            } else {
+                e->sector_count = fs->sector_count - e->start_sector;
+            }
+        }
+
+        if ( e->start_sector + e->sector_count > expect ) {
+            expect = e->start_sector + e->sector_count;
+        }
+
+        if ( !quiet ) {
+            printf( "entry %u (%s): sectors %lu+%lu\n",
+                    i, e->name, (unsigned long)e->start_sector, (unsigned long)e->sector_count );
+        }
+    }
+}
+
+static void check_file_header( int fd, uint16_t sector_size, FsckEntry *entry )
+{
+    /* ログファイル先頭 */
+    FsckReader *reader;
+
+    reader = malloc( sizeof( FsckReader ) );
+
+    if ( reader == NULL ) {
+        return;
+    }
+
+    reader_init( reader, fd, sector_size, entry );
+
+    if ( reader_byte( reader, 0 ) == DEVICE_LOG_V2_SIGNATURE ) {
+        entry->version = 2;
+    } else {
+        entry->version = 1;
+
+        if ( reader_byte( reader, 0 ) != DEVICE_LOG_SIGNATURE ) {
+            report( "entry %u (%s): missing log signature", entry->id, entry->name );
+        }
+    }
+
+    free( reader );
+}
+
+static void stitch_file( FsckWork *work, FsckChunk *chunks, uint32_t count )
+{
+    /* 1ファイル分のチャンク結果を順番につなぐ */
+    FsckEntry *entry = chunks[0].entry;
+    FsckReader *reader = NULL;
+    FsckChunk *c;
+    uint64_t expect = LOG_HEADER_SIZE;
+    uint64_t records = 0;
+    char known = 1;
+    char ended = 0;
+    char have_clock = 0;
+    uint32_t last_clock = 0;
+    uint32_t i;
+
+    for ( i = 0; i < count; i++ ) {
+        c = &chunks[i];
+
+        if ( ended ) {
+            /* 終了後はすべて0埋めのはず */
+            if ( !c->all_zero && c->synced ) {
+                report( "entry %u (%s): records after end signature near byte %llu",
+                        entry->id, entry->name, (unsigned long long)c->sync_offset );
+            } else if ( !c->all_zero ) {
+                report( "entry %u (%s): non-zero data after end signature in bytes %llu-%llu",
+                        entry->id, entry->name, (unsigned long long)c->begin, (unsigned long long)c->end );
+            }
+            continue;
+        }
+
+        /* 前のチャンクの終わりと食い違っていれば前の終わりから読み直す */
+        if ( i > 0 && known && ( !c->synced || c->sync_offset != expect ) && expect < c->end ) {
+            if ( reader == NULL ) {
+                reader = malloc( sizeof( FsckReader ) );
+
+                if ( reader == NULL ) {
+                    return;
+                }
+
+                reader_init( reader, work->fd, work->sector_size, entry );
+            }
+
+            parse_chunk( reader, c, expect, 1 );
+        } else if ( i > 0 && known && expect >= c->end ) {
+            /* 前のチャンクの最後のレコードがこのチャンクを丸ごと覆った */
+            continue;
+        }
+
+        if ( c->errors ) {
+            report( "entry %u (%s): %s (%lu errors in chunk)",
+                    entry->id, entry->name, c->first_error, (unsigned long)c->errors );
+        }
+
+        if ( c->synced && c->clock_known ) {
+            if ( have_clock && c->first_clock < last_clock ) {
+                report( "entry %u (%s): timestamp went backwards near byte %llu",
+                        entry->id, entry->name, (unsigned long long)c->sync_offset );
+            }
+
+            last_clock = c->last_clock;
+            have_clock = 1;
+        }
+
+        if ( !c->synced && !c->all_zero ) {
+            report( "entry %u (%s): no records found in bytes %llu-%llu",
+                    entry->id, entry->name, (unsigned long long)c->begin, (unsigned long long)c->end );
+        }
+
+        records += c->records;
+        ended = c->ended;
+        known = c->exit_known;
+        expect = c->exit_offset;
+    }
+
+    if ( !ended ) {
+        report( "entry %u (%s): no end signature (logging interrupted?)", entry->id, entry->name );
+    }
+
+    if ( !quiet ) {
+        printf( "entry %u (%s): %llu records\n", entry->id, entry->name, (unsigned long long)records );
+    }
+
+    free( reader );
+}
+
+static void check_files( MicomFS *fs, FsckEntry *entries, int threads )
+{
+    /* 全ファイルのチャンクを並列で検査 */
+    FsckWork work;
+    pthread_t tid[MAX_THREADS];
+    uint64_t length, pos;
+    uint32_t n, i, first;
+    uint16_t e;
+    int t;
+
+    work.fd = micomfs_dev_host_fd( fs );
+    work.sector_size = fs->sector_size;
+    work.next = 0;
+    work.chunk_count = 0;
+    pthread_mutex_init( &work.lock, NULL );
+
+    /* チャンク数を数えて確保 */
+    n = 0;
+
+    for ( e = 0; e < fs->used_entry_count; e++ ) {
+        if ( entries[e].flag == MicomFSFileFlagNormal && entries[e].sector_count ) {
+            length = (uint64_t)entries[e].sector_count * fs->sector_size;
+            n += ( length + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+        }
+    }
+
+    work.chunks = calloc( n ? n : 1, sizeof( FsckChunk ) );
+
+    if ( work.chunks == NULL ) {
+        report( "out of memory" );
+        return;
+    }
+
+    for ( e = 0; e < fs->used_entry_count; e++ ) {
+        if ( entries[e].flag != MicomFSFileFlagNormal || !entries[e].sector_count ) {
+            continue;
+        }
+
+        check_file_header( work.fd, fs->sector_size, &entries[e] );
+
+        length = (uint64_t)entries[e].sector_count * fs->sector_size;
+
+        for ( pos = 0, i = 0; pos < length; pos += CHUNK_SIZE, i++ ) {
+            work.chunks[work.chunk_count].entry = &entries[e];
+            work.chunks[work.chunk_count].index = i;
+            work.chunks[work.chunk_count].begin = ( i == 0 ) ? LOG_HEADER_SIZE : pos;
+            work.chunks[work.chunk_count].end   = ( length - pos < CHUNK_SIZE ) ? length : pos + CHUNK_SIZE;
+            work.chunk_count++;
+        }
+    }
+
+    /* 並列検査 */
+    if ( threads > (int)work.chunk_count ) {
+        threads = work.chunk_count;
+    }
+
+    for ( t = 0; t < threads; t++ ) {
+        if ( pthread_create( &tid[t], NULL, worker, &work ) != 0 ) {
+            break;
+        }
+    }
+
+    /* スレッドが作れなければこのスレッドでやる */
+    if ( t == 0 ) {
+        worker( &work );
+    }
+
+    while ( t-- > 0 ) {
+        pthread_join( tid[t], NULL );
+    }
+
+    /* ファイルごとにつなぐ */
+    for ( first = 0, i = 1; i <= work.chunk_count; i++ ) {
+        if ( i == work.chunk_count || work.chunks[i].index == 0 ) {
+            stitch_file( &work, &work.chunks[first], i - first );
+            first = i;
+        }
+    }
+
+    pthread_mutex_destroy( &work.lock );
+    free( work.chunks );
+}
+
+int main( int argc, char **argv )
+{
+    MicomFS fs;
+    FsckEntry *entries;
+    int threads;
+    int opt;
+
+    threads = sysconf( _SC_NPROCESSORS_ONLN );
+    quiet = 0;
+
+    while ( ( opt = getopt( argc, argv, "j:q" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'j':
+            threads = atoi( optarg );
+            break;
+
+        case 'q':
+            quiet = 1;
+            break;
+
+        default:
+            fprintf( stderr, "usage: micomfs_fsck [-j THREADS] [-q] IMAGE\n" );
+            return 2;
+        }
+    }
+
+    if ( optind != argc - 1 ) {
+        fprintf( stderr, "usage: micomfs_fsck [-j THREADS] [-q] IMAGE\n" );
+        return 2;
+    }
+
+    if ( threads < 1 ) {
+        threads = 1;
+    } else if ( threads > MAX_THREADS ) {
+        threads = MAX_THREADS;
+    }
+
+    memset( &fs, 0, sizeof( fs ) );
+
+    if ( !micomfs_open_device( &fs, argv[optind], MicomFSDeviceAuto, MicomFSDeviceModeRead ) ) {
+        perror( argv[optind] );
+        return 1;
+    }
+
+    problems = 0;
+
+    if ( check_superblock( &fs ) ) {
+        entries = calloc( fs.used_entry_count ? fs.used_entry_count : 1, sizeof( FsckEntry ) );
+
+        if ( entries != NULL ) {
+            check_entries( &fs, entries );
+            check_files( &fs, entries, threads );
+            free( entries );
+        }
+    }
+
+    micomfs_close_device( &fs );
+
+    printf( "%s: %d problem%s found\n", argv[optind], problems, ( problems == 1 ) ? "" : "s" );
+
+    return problems ? 1 : 0;
+}
@@ -0,0 +1,567 @@
+/*
+ * micomfs PC用コマンドラインツール
+ *
+ * micomfs_tool ls      IMAGE
+ * micomfs_tool cat     IMAGE NAME
+ * micomfs_tool extract IMAGE [-o DIR] [NAME...]
+ * micomfs_tool sync    IMAGE DIR
+ *
+ * IMAGEはddで吸い出したイメージファイルでも，カードのブロックデバイスでも構いません．
+ * ファイルの中身はmicomfs_seq_freadを通さず，copy_file_range( 使えなければsendfile )で
+ * デバイスから直接コピーします．
+ *
+ * syncは前回の同期時のused_entry_countと各エントリーのsector_countをDIR/.micomfs_syncに覚えておき，
+ * 新しいエントリーと，前回から増えたセクターだけをコピーします．
+ * エントリーの開始セクターや名前が変わっていれば ( フォーマットし直したカードなど ) 全部コピーし直します．
+ * 名前が使えないエントリーやコピーに失敗したエントリーは報告して飛ばし，同期していないものとして状態に残します．
+ * 状態ファイルの名前は長さ付きで書くので，空の名前や空白で始まる名前もそのまま覚えられます．
+ *  micomfs-sync 2
+ *  fs <sector_count> <entry_count> <used_entry_count>
+ *  <id> <synced> <start_sector> <sector_count> <名前の長さ> <名前>
+ *
+ */
+
+#define _GNU_SOURCE
+#include "micomfs.h"
+#include "micomfs_dev_host.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#define COPY_CHUNK_SIZE ( 1024 * 1024 * 1024 )
+#define SYNC_STATE_NAME ".micomfs_sync"
+#define SYNC_STATE_VERSION 2
+
+/* エントリー名はuint8_tで数えられるので256あれば溢れない */
+typedef struct {
+    MicomFSFile file;
+    char name[256];
+} ToolEntry;
+
+/* 前回同期したときのエントリー */
+typedef struct {
+    char synced;                /* 0なら次回は最初からコピー */
+    uint32_t start_sector;
+    uint32_t sector_count;
+    char name[256];
+} SyncEntry;
+
+/* 前回同期したときのファイルシステム */
+typedef struct {
+    uint32_t sector_count;
+    uint16_t entry_count;
+    uint16_t used_entry_count;
+    SyncEntry *entries;
+} SyncState;
+
+static void usage( void )
+{
+    fprintf( stderr,
+             "usage: micomfs_tool ls      IMAGE\n"
+             "       micomfs_tool cat     IMAGE NAME\n"
+             "       micomfs_tool extract IMAGE [-o DIR] [NAME...]\n"
+             "       micomfs_tool sync    IMAGE DIR\n" );
+}
+
+static const char *flag_name( uint8_t flag )
+{
+    /* フラグを文字列に */
+    switch ( flag ) {
+    case MicomFSFileFlagNormal:
+        return "normal";
+
+    case MicomFSFileFlagDeleted:
+        return "deleted";
+
+    default:
+        return "unknown";
+    }
+}
+
+static char read_entry( MicomFS *fs, ToolEntry *entry, uint16_t id )
+{
+    /* エントリーを読んで範囲をデバイス内に丸める ( 書き込み中に止まったファイルは予約数のままなので ) */
+    entry->file.name = entry->name;
+
+    if ( !micomfs_read_entry( fs, &entry->file, id, NULL ) ) {
+        return 0;
+    }
+
+    if ( entry->file.start_sector >= fs->sector_count ) {
+        entry->file.sector_count = 0;
+    } else if ( entry->file.sector_count > fs->sector_count - entry->file.start_sector ) {
+        entry->file.sector_count = fs->sector_count - entry->file.start_sector;
+    }
+
+    return 1;
+}
+
+static char copy_extent( int in_fd, off_t offset, int out_fd, uint64_t length )
+{
+    /* デバイスの指定範囲をカーネル内でコピーする */
+    ssize_t n;
+    size_t chunk;
+    char use_sendfile = 0;
+
+    while ( length > 0 ) {
+        chunk = ( length > COPY_CHUNK_SIZE ) ? COPY_CHUNK_SIZE : length;
+
+        if ( !use_sendfile ) {
+            n = copy_file_range( in_fd, &offset, out_fd, NULL, chunk, 0 );
+
+            /* ブロックデバイス→パイプなど対応していない組み合わせならsendfileへ */
+            if ( n < 0 && ( errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF ) ) {
+                use_sendfile = 1;
+                continue;
+            }
+        } else {
+            n = sendfile( out_fd, in_fd, &offset, chunk );
+        }
+
+        if ( n < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+
+            perror( "copy" );
+            return 0;
+        }
+
+        /* 途中でデバイスが終わった */
+        if ( n == 0 ) {
+            fprintf( stderr, "copy: unexpected end of device\n" );
+            return 0;
+        }
+
+        length -= n;
+    }
+
+    return 1;
+}
+
+static char copy_entry( MicomFS *fs, ToolEntry *entry, uint32_t first_sector, int out_fd )
+{
+    /* ファイルのfirst_sector以降をout_fdの現在位置へコピー */
+    off_t offset;
+    uint64_t length;
+
+    if ( first_sector >= entry->file.sector_count ) {
+        return 1;
+    }
+
+    offset = (off_t)( entry->file.start_sector + first_sector ) * fs->sector_size;
+    length = (uint64_t)( entry->file.sector_count - first_sector ) * fs->sector_size;
+
+    return copy_extent( micomfs_dev_host_fd( fs ), offset, out_fd, length );
+}
+
+static char find_entry( MicomFS *fs, ToolEntry *entry, const char *name )
+{
+    /* 名前でエントリーを探す */
+    uint16_t i;
+
+    for ( i = 0; i < fs->used_entry_count; i++ ) {
+        if ( read_entry( fs, entry, i ) && strcmp( entry->name, name ) == 0 ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_ls( MicomFS *fs )
+{
+    /* エントリー一覧 */
+    ToolEntry entry;
+    uint16_t i;
+
+    printf( "%-5s %-24s %10s %10s %12s %s\n", "id", "name", "start", "sectors", "bytes", "flag" );
+
+    for ( i = 0; i < fs->used_entry_count; i++ ) {
+        if ( !read_entry( fs, &entry, i ) ) {
+            fprintf( stderr, "ls: failed to read entry %u\n", i );
+            return 1;
+        }
+
+        printf( "%-5u %-24s %10lu %10lu %12llu %s (0x%02X)\n",
+                i, entry.name,
+                (unsigned long)entry.file.start_sector,
+                (unsigned long)entry.file.sector_count,
+                (unsigned long long)entry.file.sector_count * fs->sector_size,
+                flag_name( entry.file.flag ), entry.file.flag );
+    }
+
+    return 0;
+}
+
+static int cmd_cat( MicomFS *fs, const char *name )
+{
+    /* 標準出力へ */
+    ToolEntry entry;
+
+    if ( !find_entry( fs, &entry, name ) ) {
+        fprintf( stderr, "cat: %s: no such file\n", name );
+        return 1;
+    }
+
+    return copy_entry( fs, &entry, 0, STDOUT_FILENO ) ? 0 : 1;
+}
+
+static char safe_name( const char *name )
+{
+    /* ディレクトリを抜け出す名前は拒否 */
+    return name[0] != '\0' && strchr( name, '/' ) == NULL && strcmp( name, "." ) != 0 && strcmp( name, ".." ) != 0;
+}
+
+static char extract_one( MicomFS *fs, ToolEntry *entry, const char *dir )
+{
+    /* 1ファイル取り出し */
+    char path[4096];
+    int out_fd;
+    char ret;
+
+    if ( !safe_name( entry->name ) ) {
+        fprintf( stderr, "extract: skipping entry %u with unsafe name\n", entry->file.entry_id );
+        return 0;
+    }
+
+    snprintf( path, sizeof( path ), "%s/%s", dir, entry->name );
+
+    out_fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    if ( out_fd < 0 ) {
+        perror( path );
+        return 0;
+    }
+
+    ret = copy_entry( fs, entry, 0, out_fd );
+
+    if ( close( out_fd ) < 0 ) {
+        ret = 0;
+    }
+
+    if ( ret ) {
+        printf( "%s\n", path );
+    }
+
+    return ret;
+}
+
+static int cmd_extract( MicomFS *fs, int argc, char **argv )
+{
+    /* 指定ファイル ( 指定なしなら全部 ) を取り出す */
+    ToolEntry entry;
+    const char *dir = ".";
+    uint16_t i;
+    int failed = 0;
+
+    if ( argc >= 2 && strcmp( argv[0], "-o" ) == 0 ) {
+        dir = argv[1];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if ( argc == 0 ) {
+        for ( i = 0; i < fs->used_entry_count; i++ ) {
+            if ( !read_entry( fs, &entry, i ) || !extract_one( fs, &entry, dir ) ) {
+                failed = 1;
+            }
+        }
+    } else {
+        for ( ; argc > 0; argc--, argv++ ) {
+            if ( !find_entry( fs, &entry, argv[0] ) ) {
+                fprintf( stderr, "extract: %s: no such file\n", argv[0] );
+                failed = 1;
+            } else if ( !extract_one( fs, &entry, dir ) ) {
+                failed = 1;
+            }
+        }
+    }
+
+    return failed;
+}
+
+static char sync_load( const char *dir, SyncState *state )
+{
+    /* 前回の同期状態を読む ( なければ空，読めない行があれば0 ) */
+    char path[4096];
+    FILE *file;
+    unsigned int version, id, synced, length;
+    unsigned long sector_count, start, count;
+    unsigned int entry_count, used;
+    SyncEntry *entry;
+    int c;
+
+    memset( state, 0, sizeof( *state ) );
+    snprintf( path, sizeof( path ), "%s/%s", dir, SYNC_STATE_NAME );
+
+    file = fopen( path, "r" );
+
+    if ( file == NULL ) {
+        return 1;
+    }
+
+    if ( fscanf( file, "micomfs-sync %u\n", &version ) != 1 || version != SYNC_STATE_VERSION ||
+         fscanf( file, "fs %lu %u %u\n", &sector_count, &entry_count, &used ) != 3 ) {
+        fprintf( stderr, "sync: %s: unknown state, doing a full copy\n", path );
+        fclose( file );
+        return 1;
+    }
+
+    state->sector_count     = sector_count;
+    state->entry_count      = entry_count;
+    state->used_entry_count = used;
+    state->entries = calloc( used ? used : 1, sizeof( SyncEntry ) );
+
+    if ( state->entries == NULL ) {
+        fclose( file );
+        return 0;
+    }
+
+    /* 1行ずつ ( 名前は長さの後の空白1つに続くバイト列 ) */
+    while ( ( c = fgetc( file ) ) != EOF ) {
+        ungetc( c, file );
+
+        if ( fscanf( file, "%u %u %lu %lu %u", &id, &synced, &start, &count, &length ) != 5 ||
+             id >= used || length > 255 || fgetc( file ) != ' ' ) {
+            break;
+        }
+
+        entry = &state->entries[id];
+
+        if ( fread( entry->name, 1, length, file ) != length || fgetc( file ) != '\n' ) {
+            break;
+        }
+
+        entry->name[length]  = '\0';
+        entry->synced        = ( synced != 0 );
+        entry->start_sector  = start;
+        entry->sector_count  = count;
+    }
+
+    /* 途中で止まったら壊れている */
+    if ( !feof( file ) || ferror( file ) ) {
+        fprintf( stderr, "sync: %s: broken state file\n", path );
+        fclose( file );
+        free( state->entries );
+        state->entries = NULL;
+        return 0;
+    }
+
+    fclose( file );
+
+    return 1;
+}
+
+static char sync_save( const char *dir, MicomFS *fs, const SyncEntry *entries )
+{
+    /* 同期状態を書き出す ( 途中で止まっても前回の状態が残るようにrenameで置き換え ) */
+    char path[4096], tmp_path[4096 + 8];
+    FILE *file;
+    uint16_t i;
+
+    snprintf( path, sizeof( path ), "%s/%s", dir, SYNC_STATE_NAME );
+    snprintf( tmp_path, sizeof( tmp_path ), "%s.tmp", path );
+
+    file = fopen( tmp_path, "w" );
+
+    if ( file == NULL ) {
+        perror( tmp_path );
+        return 0;
+    }
+
+    fprintf( file, "micomfs-sync %u\n", SYNC_STATE_VERSION );
+    fprintf( file, "fs %lu %u %u\n", (unsigned long)fs->sector_count, fs->entry_count, fs->used_entry_count );
+
+    for ( i = 0; i < fs->used_entry_count; i++ ) {
+        fprintf( file, "%u %u %lu %lu %u %s\n", i, entries[i].synced,
+                 (unsigned long)entries[i].start_sector,
+                 (unsigned long)entries[i].sector_count,
+                 (unsigned int)strlen( entries[i].name ), entries[i].name );
+    }
+
+    if ( ferror( file ) ) {
+        fclose( file );
+        fprintf( stderr, "sync: %s: write error\n", tmp_path );
+        return 0;
+    }
+
+    if ( fclose( file ) != 0 || rename( tmp_path, path ) < 0 ) {
+        perror( path );
+        return 0;
+    }
+
+    return 1;
+}
+
+static char sync_one( MicomFS *fs, ToolEntry *entry, const SyncEntry *last, const char *dir, uint64_t *copied )
+{
+    /* 1エントリーの差分コピー */
+    char path[4096];
+    uint32_t first_sector = 0;
+    int out_fd;
+    int flags = O_WRONLY | O_CREAT;
+    char ret;
+
+    if ( !safe_name( entry->name ) ) {
+        fprintf( stderr, "sync: skipping entry %u with unsafe name\n", entry->file.entry_id );
+        return 0;
+    }
+
+    snprintf( path, sizeof( path ), "%s/%s", dir, entry->name );
+
+    /* 同じファイルで増えただけなら続きから，そうでなければ最初から */
+    if ( last != NULL && last->synced && last->start_sector == entry->file.start_sector &&
+         last->sector_count <= entry->file.sector_count && strcmp( last->name, entry->name ) == 0 &&
+         access( path, F_OK ) == 0 ) {
+        first_sector = last->sector_count;
+    } else {
+        flags |= O_TRUNC;
+    }
+
+    if ( first_sector == entry->file.sector_count && !( flags & O_TRUNC ) ) {
+        return 1;
+    }
+
+    out_fd = open( path, flags, 0644 );
+
+    if ( out_fd < 0 ) {
+        perror( path );
+        return 0;
+    }
+
+    if ( lseek( out_fd, (off_t)first_sector * fs->sector_size, SEEK_SET ) < 0 ) {
+        perror( path );
+        close( out_fd );
+        return 0;
+    }
+
+    ret = copy_entry( fs, entry, first_sector, out_fd );
+
+    /* 前回より短くなることはないが念のため長さを合わせる */
+    if ( ret && ftruncate( out_fd, (off_t)entry->file.sector_count * fs->sector_size ) < 0 ) {
+        ret = 0;
+    }
+
+    if ( close( out_fd ) < 0 ) {
+        ret = 0;
+    }
+
+    if ( ret ) {
+        printf( "%s: +%lu sectors\n", path, (unsigned long)( entry->file.sector_count - first_sector ) );
+        *copied += entry->file.sector_count - first_sector;
+    }
+
+    return ret;
+}
+
+static int cmd_sync( MicomFS *fs, const char *dir )
+{
+    /* 前回からの差分だけコピー ( 失敗したエントリーは飛ばして状態は必ず残す ) */
+    SyncState state;
+    ToolEntry entry;
+    SyncEntry *next;
+    const SyncEntry *last;
+    uint64_t copied = 0;
+    uint16_t i;
+    int failed = 0;
+
+    if ( !sync_load( dir, &state ) ) {
+        return 1;
+    }
+
+    /* 別のカードやフォーマットし直したカードなら前回の情報は使わない */
+    if ( state.sector_count != fs->sector_count || state.entry_count != fs->entry_count ||
+         state.used_entry_count > fs->used_entry_count ) {
+        state.used_entry_count = 0;
+    }
+
+    next = calloc( fs->used_entry_count ? fs->used_entry_count : 1, sizeof( SyncEntry ) );
+
+    if ( next == NULL ) {
+        free( state.entries );
+        return 1;
+    }
+
+    for ( i = 0; i < fs->used_entry_count; i++ ) {
+        if ( !read_entry( fs, &entry, i ) ) {
+            fprintf( stderr, "sync: failed to read entry %u\n", i );
+            failed = 1;
+            continue;
+        }
+
+        /* 同期できなくても次回比べられるように名前と位置は覚える */
+        next[i].start_sector = entry.file.start_sector;
+        next[i].sector_count = entry.file.sector_count;
+        strcpy( next[i].name, entry.name );
+
+        if ( !safe_name( entry.name ) ) {
+            fprintf( stderr, "sync: skipping entry %u with unsafe name\n", i );
+            continue;
+        }
+
+        last = ( i < state.used_entry_count ) ? &state.entries[i] : NULL;
+
+        if ( !sync_one( fs, &entry, last, dir, &copied ) ) {
+            fprintf( stderr, "sync: failed to copy entry %u, retrying from the start next time\n", i );
+            failed = 1;
+            continue;
+        }
+
+        next[i].synced = 1;
+    }
+
+    /* 飛ばしたエントリーは同期していないとして状態を進める */
+    if ( !sync_save( dir, fs, next ) ) {
+        failed = 1;
+    }
+
+    printf( "%u entries, %llu sectors copied\n", fs->used_entry_count, (unsigned long long)copied );
+
+    free( next );
+    free( state.entries );
+
+    return failed;
+}
+
+int main( int argc, char **argv )
+{
+    MicomFS fs;
+    int ret;
+
+    if ( argc < 3 ) {
+        usage();
+        return 2;
+    }
+
+    memset( &fs, 0, sizeof( fs ) );
+
+    if ( !micomfs_open_device( &fs, argv[2], MicomFSDeviceAuto, MicomFSDeviceModeRead ) ) {
+        perror( argv[2] );
+        return 1;
+    }
+
+    if ( !micomfs_init_fs( &fs ) ) {
+        fprintf( stderr, "%s: not a micomfs image\n", argv[2] );
+        micomfs_close_device( &fs );
+        return 1;
+    }
+
+    if ( strcmp( argv[1], "ls" ) == 0 ) {
+        ret = cmd_ls( &fs );
+    } else if ( strcmp( argv[1], "cat" ) == 0 && argc == 4 ) {
+        ret = cmd_cat( &fs, argv[3] );
+    } else if ( strcmp( argv[1], "extract" ) == 0 ) {
+        ret = cmd_extract( &fs, argc - 3, argv + 3 );
+    } else if ( strcmp( argv[1], "sync" ) == 0 && argc == 4 ) {
+        ret = cmd_sync( &fs, argv[3] );
+    } else {
+        usage();
+        ret = 2;
+    }
+
+    micomfs_close_device( &fs );
+
+    return ret;
+}
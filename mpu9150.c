@@ -1,5 +1,11 @@
 #include "mpu9150.h"
+#include <string.h>
 
+static void mpu9150_unpack( MPU9150Unit *unit, const uint8_t *data );
+static void mpu9150_queue_callback( I2CTransaction *transaction );
+static char mpu9150_fifo_reset( MPU9150Unit *unit );
+static char mpu9150_fifo_check( MPU9150Unit *unit, uint8_t int_status, const uint8_t *data );
+static uint8_t mpu9150_fifo_burst_frames( MPU9150Unit *unit );
 
 char mpu9150_init( MPU9150Unit *unit, uint8_t address,
                    uint8_t sample_rate_divider, MPU9150LPFCFG lpf_cfg,
@@ -9,6 +15,29 @@ char mpu9150_init( MPU9150Unit *unit, uint8_t address,
     uint8_t data;
     unit->address = address;
 
+    /* キュー読み込み準備 */
+    unit->transaction.slave    = address;
+    unit->transaction.rw       = I2CR;
+    unit->transaction.data     = unit->buffer;
+    unit->transaction.callback = mpu9150_queue_callback;
+    unit->transaction.user     = unit;
+    unit->transaction.speed    = NULL;
+    unit->transaction.status   = I2CSuccess;
+    unit->fresh = 0;
+
+    unit->ext_size      = 0;
+    unit->frame_size    = MPU9150_FRAME_SIZE;
+    unit->user_ctrl     = 0x00;
+    unit->fifo_en       = 0x00;
+    unit->fifo_frames   = 0;
+    unit->fifo_pos      = 0;
+    unit->fifo_count    = 0;
+    unit->fifo_overflow = 0;
+    unit->fifo_restore  = 0;
+
+    /* ジャイロの出力レートはDLPFが0か7なら8kHz，それ以外は1kHz */
+    unit->sample_period = ( ( lpf_cfg == MPU9150LPFCFG0 || lpf_cfg == MPU9150LPFCFG7 ) ? 125UL : 1000UL ) * ( 1 + sample_rate_divider );
+
     /* デバイスID確認 */
     if ( !i2c_read_register( unit->address, 0x75, &data, 1, I2CPolling ) ) {
         return 0;
@@ -88,12 +117,19 @@ char mpu9150_sleep( MPU9150Unit *unit )
 char mpu9150_read( MPU9150Unit *unit )
 {
     /* データを読む */
-    uint8_t data[14];
+    uint8_t data[MPU9150_FRAME_SIZE + MPU9150_EXT_SIZE];
 
-    if ( !i2c_read_register( unit->address, 0x3B, data, 14, I2CPolling ) ) {
+    if ( !i2c_read_register( unit->address, 0x3B, data, unit->frame_size, I2CPolling ) ) {
         return 0;
     }
 
+    mpu9150_unpack( unit, data );
+
+    return 1;
+}
+
+static void mpu9150_unpack( MPU9150Unit *unit, const uint8_t *data )
+{
     /* 構造体に振り分け */
     unit->acc_x  = ( data[0]  << 8 ) | data[1];
     unit->acc_y  = ( data[2]  << 8 ) | data[3];
@@ -103,6 +139,25 @@ char mpu9150_read( MPU9150Unit *unit )
     unit->gyro_y = ( data[10] << 8 ) | data[11];
     unit->gyro_z = ( data[12] << 8 ) | data[13];
 
+    /* 補助I2Cのデータ */
+    memcpy( unit->ext, &data[MPU9150_FRAME_SIZE], unit->ext_size );
+}
+
+char mpu9150_poll_read( MPU9150Unit *unit )
+{
+    /* INT_STATUS ( 0x3A ) からデータ ( 0x3B- ) まで続けて読み，データレディーなら振り分けて1 */
+    uint8_t data[1 + MPU9150_FRAME_SIZE + MPU9150_EXT_SIZE];
+
+    if ( !i2c_read_register( unit->address, 0x3A, data, 1 + unit->frame_size, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !( data[0] & 0x01 ) ) {
+        return 0;
+    }
+
+    mpu9150_unpack( unit, &data[1] );
+
     return 1;
 }
 
@@ -118,6 +173,396 @@ char mpu9150_data_ready( MPU9150Unit *unit )
     return data & 0x01;
 }
 
+static void mpu9150_queue_callback( I2CTransaction *transaction )
+{
+    /* 割り込み中: データレディーならデータを使えるようにする ( FIFOならFIFO_COUNT -> バースト ) */
+    MPU9150Unit *unit = transaction->user;
+    uint8_t frames;
+
+    if ( transaction->status != I2CSuccess ) {
+        /* 失敗 ( FIFO_ENを戻す書き込みならfifo_restoreが残るので次の読み込みで書き直す ) */
+        return;
+    }
+
+    switch ( transaction->address ) {
+    case 0x3A:
+        if ( transaction->data == &unit->int_status ) {
+            /* FIFO: INT_STATUSを覚えてFIFO_COUNTへ */
+            transaction->address = 0x72;
+            transaction->data    = unit->buffer;
+            transaction->size    = 2;
+
+            i2c_queue_push( transaction );
+            break;
+        }
+
+        /* INT_STATUS + データ */
+        unit->fresh = unit->buffer[0] & 0x01;
+        break;
+
+    case 0x72:
+        /* FIFO_COUNT */
+        if ( !mpu9150_fifo_check( unit, unit->int_status, unit->buffer ) ) {
+            /* 溢れたのでリセット ( FIFO_ENを落としてFIFO_RESET ) */
+            unit->command      = ( unit->user_ctrl & ~0x40 ) | 0x04;
+            unit->fifo_restore = 1;
+
+            transaction->address = 0x6A;
+            transaction->rw      = I2CW;
+            transaction->data    = &unit->command;
+            transaction->size    = 1;
+
+            i2c_queue_push( transaction );
+        } else if ( ( frames = mpu9150_fifo_burst_frames( unit ) ) ) {
+            transaction->address = 0x74;
+            transaction->data    = unit->fifo_buffer;
+            transaction->size    = frames * unit->frame_size;
+
+            i2c_queue_push( transaction );
+        }
+        break;
+
+    case 0x74:
+        /* FIFO_R_W */
+        unit->fifo_frames = transaction->size / unit->frame_size;
+        break;
+
+    case 0x6A:
+        /* リセット後にFIFO_ENを戻す */
+        if ( unit->command & 0x04 ) {
+            unit->command = unit->user_ctrl;
+
+            i2c_queue_push( transaction );
+            break;
+        }
+
+        /* 戻せたのでINT_STATUSから読み直す */
+        unit->fifo_restore = 0;
+
+        transaction->address = 0x3A;
+        transaction->rw      = I2CR;
+        transaction->data    = &unit->int_status;
+        transaction->size    = 1;
+
+        i2c_queue_push( transaction );
+        break;
+
+    default:
+        break;
+    }
+}
+
+char mpu9150_queue_read( MPU9150Unit *unit )
+{
+    /* INT_STATUSとデータの読み込みをキューに入れる */
+    unit->transaction.address = 0x3A;
+    unit->transaction.rw      = I2CR;
+    unit->transaction.data    = unit->buffer;
+    unit->transaction.size    = 1 + unit->frame_size;
+
+    return i2c_queue_push( &unit->transaction );
+}
+
+char mpu9150_queue_busy( MPU9150Unit *unit )
+{
+    /* キュー読み込み中か */
+    return ( unit->transaction.status == I2CWorking );
+}
+
+char mpu9150_queue_fetch( MPU9150Unit *unit )
+{
+    /* キュー読み込みで新しいデータが来ていれば構造体に振り分けて1 */
+    if ( mpu9150_queue_busy( unit ) || !unit->fresh ) {
+        return 0;
+    }
+
+    mpu9150_unpack( unit, &unit->buffer[1] );
+    unit->fresh = 0;
+
+    return 1;
+}
+
+char mpu9150_fifo_enable( MPU9150Unit *unit )
+{
+    /* 加速度・温度・ジャイロをFIFOに入れる */
+    uint8_t data;
+
+    /* TEMP, XG, YG, ZG, ACCEL ( 補助I2Cを使っていればSLV0も ) */
+    unit->fifo_en = ( unit->ext_size ) ? 0xF9 : 0xF8;
+
+    if ( !i2c_write_register( unit->address, 0x23, &unit->fifo_en, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    /* データレディーとFIFO_OFLOW ( INT_STATUSのビット4で溢れを見る ) */
+    data = 0x11;
+
+    if ( !i2c_write_register( unit->address, 0x38, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->user_ctrl |= 0x40;
+
+    return mpu9150_fifo_reset( unit );
+}
+
+char mpu9150_fifo_disable( MPU9150Unit *unit )
+{
+    /* FIFO停止 */
+    uint8_t data;
+
+    unit->user_ctrl &= ~0x40;
+
+    if ( !i2c_write_register( unit->address, 0x6A, &unit->user_ctrl, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_restore = 0;
+    unit->fifo_en      = 0x00;
+
+    if ( !i2c_write_register( unit->address, 0x23, &unit->fifo_en, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    /* データレディーだけに戻す */
+    data = 0x01;
+
+    if ( !i2c_write_register( unit->address, 0x38, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_frames = 0;
+    unit->fifo_pos    = 0;
+
+    return 1;
+}
+
+static char mpu9150_fifo_reset( MPU9150Unit *unit )
+{
+    /* FIFO_RESETはFIFO_ENが0のときだけ効く */
+    uint8_t data;
+
+    data = ( unit->user_ctrl & ~0x40 ) | 0x04;
+
+    if ( !i2c_write_register( unit->address, 0x6A, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !i2c_write_register( unit->address, 0x6A, &unit->user_ctrl, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_restore = 0;
+    unit->fifo_frames  = 0;
+    unit->fifo_pos     = 0;
+
+    return 1;
+}
+
+static char mpu9150_fifo_check( MPU9150Unit *unit, uint8_t int_status, const uint8_t *data )
+{
+    /* FIFO_COUNTを覚えて，溢れていれば ( FIFO_OFLOW_INTかいっぱい ) 0 */
+    unit->fifo_count = ( data[0] << 8 ) | data[1];
+
+    if ( ( int_status & 0x10 ) || unit->fifo_count >= MPU9150_FIFO_SIZE ) {
+        unit->fifo_overflow++;
+        return 0;
+    }
+
+    /* 念のため: フレームの倍数でなければずれている */
+    if ( unit->fifo_count % unit->frame_size ) {
+        unit->fifo_overflow++;
+        return 0;
+    }
+
+    return 1;
+}
+
+static uint8_t mpu9150_fifo_burst_frames( MPU9150Unit *unit )
+{
+    /* 今回読むフレーム数 */
+    uint16_t frames = unit->fifo_count / unit->frame_size;
+
+    if ( frames > MPU9150_FIFO_BUFFER_SIZE / unit->frame_size ) {
+        frames = MPU9150_FIFO_BUFFER_SIZE / unit->frame_size;
+    }
+
+    return frames;
+}
+
+char mpu9150_fifo_count( MPU9150Unit *unit, uint16_t *count )
+{
+    /* FIFOにたまっているバイト数 */
+    uint8_t data[2];
+
+    if ( !i2c_read_register( unit->address, 0x72, data, 2, I2CPolling ) ) {
+        return 0;
+    }
+
+    *count = ( data[0] << 8 ) | data[1];
+
+    return 1;
+}
+
+char mpu9150_fifo_read( MPU9150Unit *unit )
+{
+    /* FIFO_COUNTを読んで，たまっているフレームをまとめて読む */
+    uint8_t frames;
+
+    unit->fifo_frames = 0;
+    unit->fifo_pos    = 0;
+
+    /* INT_STATUS ( FIFO_OFLOW_INT ) -> FIFO_COUNT */
+    if ( !i2c_read_register( unit->address, 0x3A, &unit->int_status, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !i2c_read_register( unit->address, 0x72, unit->buffer, 2, I2CPolling ) ) {
+        return 0;
+    }
+
+    /* 溢れていればリセット */
+    if ( !mpu9150_fifo_check( unit, unit->int_status, unit->buffer ) ) {
+        return mpu9150_fifo_reset( unit );
+    }
+
+    frames = mpu9150_fifo_burst_frames( unit );
+
+    if ( frames == 0 ) {
+        return 1;
+    }
+
+    if ( !i2c_read_register( unit->address, 0x74, unit->fifo_buffer, frames * unit->frame_size, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->fifo_frames = frames;
+
+    return 1;
+}
+
+char mpu9150_fifo_queue_read( MPU9150Unit *unit )
+{
+    /* INT_STATUS -> FIFO_COUNT確認をキューに入れる ( たまっていれば続けてバースト読み込み ) */
+    unit->fifo_frames = 0;
+    unit->fifo_pos    = 0;
+
+    if ( unit->fifo_restore ) {
+        /* リセット後にFIFO_ENを戻せていないので先に書く ( 書けたらINT_STATUSへ ) */
+        unit->command = unit->user_ctrl;
+
+        unit->transaction.address = 0x6A;
+        unit->transaction.rw      = I2CW;
+        unit->transaction.data    = &unit->command;
+        unit->transaction.size    = 1;
+
+        return i2c_queue_push( &unit->transaction );
+    }
+
+    unit->transaction.address = 0x3A;
+    unit->transaction.rw      = I2CR;
+    unit->transaction.data    = &unit->int_status;
+    unit->transaction.size    = 1;
+
+    return i2c_queue_push( &unit->transaction );
+}
+
+char mpu9150_fifo_fetch( MPU9150Unit *unit )
+{
+    /* 読んだフレームを1つ構造体に振り分ける */
+    if ( mpu9150_queue_busy( unit ) || unit->fifo_pos >= unit->fifo_frames ) {
+        return 0;
+    }
+
+    mpu9150_unpack( unit, &unit->fifo_buffer[unit->fifo_pos * unit->frame_size] );
+    unit->fifo_pos++;
+
+    return 1;
+}
+
+char mpu9150_aux_enable( MPU9150Unit *unit, uint8_t slave, uint8_t read_reg, uint8_t read_size,
+                         uint8_t write_reg, uint8_t write_data, uint8_t delay )
+{
+    /* 補助I2Cマスターで毎サンプル読み込み，( 1 + delay ) サンプルごとに書き込み */
+    uint8_t config[][2] = {
+        { 0x37, 0x00 },                 /* バイパス無効 */
+        { 0x24, 0x4D },                 /* WAIT_FOR_ES, 400kHz */
+        { 0x25, 0x80 | slave },         /* SLV0: 読み込み */
+        { 0x26, read_reg },
+        { 0x27, 0x80 | read_size },
+        { 0x28, slave },                /* SLV1: 書き込み */
+        { 0x29, write_reg },
+        { 0x64, write_data },
+        { 0x2A, 0x81 },
+        { 0x34, delay & 0x1F },         /* I2C_MST_DLY */
+        { 0x67, 0x02 },                 /* SLV1だけ間引く */
+    };
+    uint8_t i;
+
+    if ( read_size == 0 || read_size > MPU9150_EXT_SIZE ) {
+        return 0;
+    }
+
+    for ( i = 0; i < sizeof( config ) / sizeof( config[0] ); i++ ) {
+        if ( !i2c_write_register( unit->address, config[i][0], &config[i][1], 1, I2CPolling ) ) {
+            return 0;
+        }
+    }
+
+    /* I2C_MST_EN */
+    unit->user_ctrl |= 0x20;
+
+    if ( !i2c_write_register( unit->address, 0x6A, &unit->user_ctrl, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->ext_size   = read_size;
+    unit->frame_size = MPU9150_FRAME_SIZE + read_size;
+
+    /* FIFOを使っていればフレームが変わるので入れ直す */
+    if ( unit->user_ctrl & 0x40 ) {
+        return mpu9150_fifo_enable( unit );
+    }
+
+    return 1;
+}
+
+char mpu9150_aux_disable( MPU9150Unit *unit )
+{
+    /* 補助I2Cマスター停止してバイパスに戻す */
+    uint8_t data;
+
+    unit->user_ctrl &= ~0x20;
+
+    if ( !i2c_write_register( unit->address, 0x6A, &unit->user_ctrl, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    data = 0x00;
+
+    if ( !i2c_write_register( unit->address, 0x27, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    if ( !i2c_write_register( unit->address, 0x2A, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    data = 0x02;
+
+    if ( !i2c_write_register( unit->address, 0x37, &data, 1, I2CPolling ) ) {
+        return 0;
+    }
+
+    unit->ext_size   = 0;
+    unit->frame_size = MPU9150_FRAME_SIZE;
+
+    if ( unit->user_ctrl & 0x40 ) {
+        return mpu9150_fifo_enable( unit );
+    }
+
+    return 1;
+}
 
 float mpu9150_get_temp_in_c( MPU9150Unit *unit )
 {
@@ -3,6 +3,30 @@
 
 #include "i2c.h"
 
+/*
+ * FIFO
+ *  mpu9150_fifo_enable()で加速度・温度・ジャイロを1KBのFIFOに入れるようにすると，
+ *  FIFO_COUNTを読んでからMPU9150_FIFO_BUFFER_SIZEバイトに入るだけのフレームをまとめて1回のバーストで読み出せる．
+ *  フレームの並びは0x3B-0x48 ( 補助I2Cを使っていれば続けてEXT_SENS_DATA ) と同じなので，
+ *  取り出した後は普通の読み込みと同じ構造体に入る．
+ *  FIFO_COUNTの前にINT_STATUSを読み，FIFO_OFLOW_INT ( ビット4 ) が立っているかFIFO_COUNTが1024なら溢れている．
+ *  ( 1024がフレームサイズの倍数 ( 16など ) だと溢れてもフレームはずれないので，FIFO_COUNTの剰余だけでは分からない )
+ *  その場合はFIFOをリセットしてfifo_overflowを1増やす．( 中のデータは捨てる )
+ *  リセット後にFIFO_ENを戻す書き込みが失敗したら，次のmpu9150_fifo_queue_read()でINT_STATUSの前に書き直す．
+ *  FIFO_COUNTがフレームサイズの倍数でないときも，ずれているので同じようにリセットする．
+ *
+ * 補助I2Cマスター
+ *  mpu9150_aux_enable()でバイパスを切り，MPU9150の補助I2Cマスターに
+ *  SLV0: 毎サンプルslaveのread_regからread_sizeバイトをEXT_SENS_DATA ( 0x49- ) に読む
+ *  SLV1: ( 1 + delay ) サンプルごとにslaveのwrite_regへwrite_dataを書く
+ *  をさせる．読んだデータはサンプル ( FIFOならフレーム ) ごとにextに入る．
+ *  バイパスを切るのでslaveには直接アクセスできなくなる．( AK8975はak8975_aux_enable()を使う )
+ */
+#define MPU9150_FIFO_SIZE        1024
+#define MPU9150_FRAME_SIZE       14      /* 加速度・温度・ジャイロ */
+#define MPU9150_EXT_SIZE         8       /* 補助I2Cで読めるバイト数 ( RAMに合わせて ) */
+#define MPU9150_FIFO_BUFFER_SIZE 112     /* 1回のバーストで読むバイト数 ( RAMに合わせて ) */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,6 +74,29 @@ typedef struct {
     int16_t gyro_y;
     int16_t gyro_z;
     int16_t temp;
+    uint32_t sample_period;             /* サンプル周期[us] */
+
+    /* キュー読み込み用 */
+    I2CTransaction transaction;
+    uint8_t buffer[1 + MPU9150_FRAME_SIZE + MPU9150_EXT_SIZE];    /* INT_STATUS + データ */
+    volatile char fresh;
+
+    /* 補助I2Cで読んだデータ */
+    uint8_t ext[MPU9150_EXT_SIZE];
+    uint8_t ext_size;
+    uint8_t frame_size;                 /* MPU9150_FRAME_SIZE + ext_size */
+
+    /* FIFO用 */
+    uint8_t user_ctrl;
+    uint8_t fifo_en;
+    uint8_t command;
+    uint8_t fifo_buffer[MPU9150_FIFO_BUFFER_SIZE];
+    volatile uint8_t fifo_frames;       /* fifo_bufferに入っているフレーム数 */
+    uint8_t fifo_pos;                   /* 次に取り出すフレーム */
+    uint16_t fifo_count;                /* 最後に読んだFIFO_COUNT */
+    uint8_t int_status;                 /* FIFO_COUNTの前に読んだINT_STATUS */
+    volatile uint16_t fifo_overflow;    /* 溢れてリセットした回数 */
+    volatile char fifo_restore;         /* リセット後にFIFO_ENを戻す書き込みが済んでいない */
 } MPU9150Unit;
 
 char mpu9150_init( MPU9150Unit *unit, uint8_t address, uint8_t sample_rate_divider, MPU9150LPFCFG lpf_cfg,
@@ -57,6 +104,25 @@ char mpu9150_init( MPU9150Unit *unit, uint8_t address, uint8_t sample_rate_divid
 char mpu9150_sleep( MPU9150Unit *unit );
 char mpu9150_data_ready( MPU9150Unit *unit );
 char mpu9150_read( MPU9150Unit *unit );
+char mpu9150_poll_read( MPU9150Unit *unit );    /* INT_STATUSとデータを1回で読む．新しいデータなら1 */
+
+/* TWI割り込みキューで INT_STATUSとデータを1回で読む ( データレディーのときだけfetchできる ) */
+char mpu9150_queue_read( MPU9150Unit *unit );
+char mpu9150_queue_busy( MPU9150Unit *unit );
+char mpu9150_queue_fetch( MPU9150Unit *unit );
+
+/* FIFO */
+char mpu9150_fifo_enable( MPU9150Unit *unit );
+char mpu9150_fifo_disable( MPU9150Unit *unit );
+char mpu9150_fifo_count( MPU9150Unit *unit, uint16_t *count );
+char mpu9150_fifo_read( MPU9150Unit *unit );            /* FIFO_COUNT -> バースト読み込み ( ブロッキング ) */
+char mpu9150_fifo_queue_read( MPU9150Unit *unit );      /* 同じことをTWI割り込みキューで */
+char mpu9150_fifo_fetch( MPU9150Unit *unit );           /* 読んだフレームを1つ構造体に振り分ける．なければ0 */
+
+/* 補助I2Cマスター */
+char mpu9150_aux_enable( MPU9150Unit *unit, uint8_t slave, uint8_t read_reg, uint8_t read_size,
+                         uint8_t write_reg, uint8_t write_data, uint8_t delay );
+char mpu9150_aux_disable( MPU9150Unit *unit );
 
 float mpu9150_get_temp_in_c( MPU9150Unit *unit );
 
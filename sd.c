@@ -409,6 +409,76 @@ char sd_stop_step_block_write()
     }
 }
 
+char sd_start_async_block_write( uint32_t address, const uint8_t *data )
+{
+    /* ブロックライトを始めて，データーは後でsd_async_block_write_processで送る ( dataは終わるまで保持 ) */
+    if ( unit.async_state != SDAsyncIdle ) {
+        return 0;
+    }
+
+    if ( !sd_start_step_block_write( address ) ) {
+        return 0;
+    }
+
+    unit.async_state = SDAsyncData;
+    spi_auto_master_start( data, NULL, unit.block_size, 0 );
+
+    return 1;
+}
+
+SDResp sd_async_block_write_process( void )
+{
+    /* 非同期ブロックライトを少し進める */
+    uint8_t data_resp;
+
+    switch ( unit.async_state ) {
+    case SDAsyncData:
+        /* データーをSD_ASYNC_STEPバイト */
+        if ( spi_auto_proccess( SD_ASYNC_STEP ) == SPIWorking ) {
+            return SDRespWorking;
+        }
+
+        /* CRC */
+        spi_write( 0x00 );
+        while ( !spi_complete() );
+        spi_write( 0x00 );
+        while ( !spi_complete() );
+
+        /* データレスポンス */
+        spi_write( 0xFF );
+        while ( !spi_complete() );
+        data_resp = spi_read();
+
+        if ( ( data_resp & 0x1F ) != 0x05 ) {
+            spi_release_slave();
+            unit.async_state = SDAsyncIdle;
+
+            return SDRespFailed;
+        }
+
+        unit.async_state = SDAsyncBusy;
+
+        return SDRespWorking;
+
+    case SDAsyncBusy:
+        /* ビジー解除を1バイトだけ見る */
+        spi_write( 0xFF );
+        while ( !spi_complete() );
+
+        if ( spi_read() == 0x00 ) {
+            return SDRespWorking;
+        }
+
+        spi_release_slave();
+        unit.async_state = SDAsyncIdle;
+
+        return SDRespSuccess;
+
+    default:
+        return SDRespSuccess;
+    }
+}
+
 char sd_start_step_block_read( uint32_t address )
 {
     /* ステップ動作のシングルブロックリード */
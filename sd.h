@@ -6,6 +6,12 @@
  *
  * spi.hがあるのが前提です
  *
+ * sd_start_async_block_writeで始めたブロックライトは，sd_async_block_write_processを呼ぶたびに
+ * データーをSPIの自動処理でSD_ASYNC_STEPバイトずつ送り，送り終わったらCRCとデータレスポンスまで済ませて，
+ * その後はカードのビジーを1バイトだけ見て戻ります．
+ * 呼び出し側はSDRespWorkingの間ほかの処理をしながら呼び続けてください．( その間ほかのSD関数は使えません )
+ * 割り込みは使わないので，割り込み禁止中に呼んでも進みます．
+ *
  * TODO CSD
  *
  */
@@ -36,6 +42,12 @@ typedef enum SDVersion_tag {
     SDV2,
 } SDVersion;
 
+typedef enum SDAsyncState_tag {
+    SDAsyncIdle,
+    SDAsyncData,        /* データー送信中 */
+    SDAsyncBusy,        /* カードのビジー解除待ち */
+} SDAsyncState;
+
 typedef enum SDAddress_tag {
     SDByte,
     SDBlock,
@@ -48,8 +60,13 @@ typedef struct SDUnit_tag {
     uint8_t cmd;
     uint32_t ret;
     uint64_t card_size;		/* card_size[Bytes] */
+
+    /* 非同期ブロックライト */
+    SDAsyncState async_state;
 } SDUnit;
 
+#define SD_ASYNC_STEP 32    /* sd_async_block_write_processで1回に送るバイト数 ( SPIOscDiv2で64us ) */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -69,6 +86,9 @@ char sd_start_step_block_write( uint32_t address );
 void sd_step_block_write( uint8_t data );
 char sd_stop_step_block_write( void );
 
+char sd_start_async_block_write( uint32_t address, const uint8_t *data );
+SDResp sd_async_block_write_process( void );
+
 char sd_start_step_block_read( uint32_t address );
 uint8_t sd_step_block_read( void );
 char sd_stop_step_block_read( void );
@@ -0,0 +1,148 @@
+#include "sd_stage.h"
+
+static char sd_stage_flush( SDStage *stage );
+
+char sd_stage_start( SDStage *stage, MicomFSFile *fp )
+{
+    /* 初期化 */
+    stage->fp       = fp;
+    stage->fill     = 0;
+    stage->pos      = 0;
+    stage->flushing = 0;
+    stage->error    = 0;
+    stage->sector   = 0;
+    stage->dropped  = 0;
+
+    /* セクターサイズが違うと書けない */
+    if ( fp->fs->sector_size != SD_STAGE_SECTOR_SIZE || fp->max_sector_count == 0 ) {
+        stage->error = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+char sd_stage_write( SDStage *stage, const void *src, uint16_t count )
+{
+    /* 今のバッファーにコピーして，埋まったら書き込みを始めてもう一方へ */
+    const uint8_t *p = src;
+    uint16_t n;
+
+    if ( stage->error ) {
+        return 0;
+    }
+
+    /* 入りきらないのにもう一方がまだ書き込み中なら，レコードを分けずに丸ごと落とす */
+    if ( stage->pos + count > SD_STAGE_SECTOR_SIZE && stage->flushing ) {
+        stage->dropped++;
+        return 0;
+    }
+
+    while ( count ) {
+        n = SD_STAGE_SECTOR_SIZE - stage->pos;
+
+        if ( n > count ) {
+            n = count;
+        }
+
+        memcpy( &stage->buffer[stage->fill][stage->pos], p, n );
+        stage->pos += n;
+        p          += n;
+        count      -= n;
+
+        if ( stage->pos == SD_STAGE_SECTOR_SIZE && !stage->flushing ) {
+            if ( !sd_stage_flush( stage ) ) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+void sd_stage_process( SDStage *stage )
+{
+    /* 書き込み中なら進めて，終わったときに次のバッファーが埋まっていればすぐ始める */
+    SDResp resp;
+
+    if ( !stage->flushing ) {
+        return;
+    }
+
+    resp = sd_async_block_write_process();
+
+    if ( resp == SDRespWorking ) {
+        return;
+    }
+
+    stage->flushing = 0;
+
+    if ( resp != SDRespSuccess ) {
+        stage->error = 1;
+        return;
+    }
+
+    if ( stage->pos == SD_STAGE_SECTOR_SIZE ) {
+        sd_stage_flush( stage );
+    }
+}
+
+char sd_stage_stop( SDStage *stage, uint8_t fill )
+{
+    /* 書き込み中のものを待って，途中のバッファーを埋めて書く */
+    while ( stage->flushing ) {
+        sd_stage_process( stage );
+    }
+
+    if ( stage->pos && !stage->error ) {
+        memset( &stage->buffer[stage->fill][stage->pos], fill, SD_STAGE_SECTOR_SIZE - stage->pos );
+        stage->pos = SD_STAGE_SECTOR_SIZE;
+
+        if ( sd_stage_flush( stage ) ) {
+            while ( stage->flushing ) {
+                sd_stage_process( stage );
+            }
+        }
+    }
+
+    return !stage->error;
+}
+
+static char sd_stage_flush( SDStage *stage )
+{
+    /* ためているバッファーの書き込みを始めて，もう一方に切り替える */
+    MicomFSFile *fp = stage->fp;
+    uint32_t address;
+
+    /* ファイルの最大セクター数を超えたら終わり */
+    if ( stage->sector >= fp->max_sector_count ) {
+        stage->error = 1;
+        return 0;
+    }
+
+    /* アドレス作成 ( micomfs_dev_start_writeと同じ ) */
+    address = fp->start_sector + stage->sector;
+
+    if ( sd_get_address_mode() == SDByte ) {
+        address *= SD_STAGE_SECTOR_SIZE;
+    }
+
+    if ( !sd_start_async_block_write( address, stage->buffer[stage->fill] ) ) {
+        stage->error = 1;
+        return 0;
+    }
+
+    /* ファイルのセクター数を合わせる */
+    fp->current_sector = stage->sector;
+
+    if ( fp->sector_count <= stage->sector ) {
+        fp->sector_count = stage->sector + 1;
+    }
+
+    stage->sector++;
+    stage->flushing = 1;
+    stage->fill ^= 1;
+    stage->pos = 0;
+
+    return 1;
+}
@@ -0,0 +1,55 @@
+/*
+ * SD書き込みの2面バッファー
+ *
+ * ログを1セクター分のRAMバッファーにためて，埋まったらsd_start_async_block_writeで書き込みを始め，
+ * その間はもう一方のバッファーにためます．書き込みはsd_stage_processを呼ぶたびに少しずつ ( データーならSD_ASYNC_STEPバイト ) 進みます．
+ * 両方のバッファーが埋まっているとき ( 書き込みが間に合わない ) は，そのレコードを丸ごと落としてdroppedを数えます．
+ * 書き込みを待つのはsd_stage_stopだけです．
+ *
+ * 書く場所はmicomfsのファイルの先頭セクターから順番で，sector_countも合わせて更新するので，
+ * 最後はsd_stage_stopの後でmicomfs_fcloseしてください．( micomfs_start_fwriteは使いません )
+ *
+ * RAMはSD_STAGE_SECTOR_SIZE * 2バイト使います．
+ *
+ */
+
+#ifndef SD_STAGE_H_INCLUDED
+#define SD_STAGE_H_INCLUDED
+
+#include "micomfs.h"
+#include "sd.h"
+
+#define SD_STAGE_SECTOR_SIZE 512
+
+typedef struct {
+    MicomFSFile *fp;
+    uint8_t buffer[2][SD_STAGE_SECTOR_SIZE];
+    uint8_t fill;               /* ためているバッファー */
+    uint16_t pos;               /* ためているバッファーの位置 */
+    char flushing;              /* もう一方を書き込み中 */
+    char error;                 /* 書き込みに失敗した ( 以降は何も書かない ) */
+    uint32_t sector;            /* 次に書くファイル内のセクター */
+    uint16_t dropped;           /* 落としたレコード数 */
+} SDStage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* fpの先頭セクターから書き始める */
+char sd_stage_start( SDStage *stage, MicomFSFile *fp );
+
+/* 1レコードをためる ( SD_STAGE_SECTOR_SIZE以下 )．落としたら0 */
+char sd_stage_write( SDStage *stage, const void *src, uint16_t count );
+
+/* 書き込みを進める ( メインループで毎回呼ぶ ) */
+void sd_stage_process( SDStage *stage );
+
+/* 残りをfillで埋めて全部書き終わるまで待つ */
+char sd_stage_stop( SDStage *stage, uint8_t fill );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
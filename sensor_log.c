@@ -0,0 +1,296 @@
+#include "sensor_log.h"
+#include <string.h>
+
+static char sensor_log_read_v1( SensorLogReader *reader, SensorLogRecord *record );
+static char sensor_log_read_v2( SensorLogReader *reader, SensorLogRecord *record );
+static char sensor_log_unpack( SensorLogReader *reader, const uint8_t *data, uint8_t size );
+static char sensor_log_pack_next( SensorLogReader *reader, SensorLogRecord *record );
+
+char sensor_log_open( SensorLogReader *reader, FILE *fp )
+{
+    /* ファイルヘッダー ( シグネチャ, 有効デバイス ) */
+    uint8_t header[2];
+
+    memset( reader, 0, sizeof( SensorLogReader ) );
+    reader->fp = fp;
+
+    if ( fread( header, 1, 2, fp ) != 2 ) {
+        return 0;
+    }
+
+    if ( header[0] == DEVICE_LOG_SIGNATURE ) {
+        reader->version = 1;
+    } else if ( header[0] == DEVICE_LOG_V2_SIGNATURE ) {
+        reader->version = 2;
+    } else {
+        return 0;
+    }
+
+    reader->devices = header[1];
+
+    return 1;
+}
+
+char sensor_log_read( SensorLogReader *reader, SensorLogRecord *record )
+{
+    /* 次のレコード */
+    if ( reader->version == 2 ) {
+        return sensor_log_read_v2( reader, record );
+    }
+
+    return sensor_log_read_v1( reader, record );
+}
+
+uint8_t sensor_log_size( uint8_t id )
+{
+    /* デバイスIDごとのデーターサイズ ( 0は不明 ) */
+    switch ( id ) {
+    case ID_LPS331AP:
+    case ID_LPS25H:
+        return 4;
+
+    case ID_ADXL345:
+    case ID_L3GD20:
+    case ID_HMC5883L:
+    case ID_MPU9150_ACC:
+    case ID_MPU9150_GYRO:
+    case ID_AK8975:
+        return 6;
+
+    case ID_MPU9150_TEMP:
+    case ID_LPS331AP_TEMP:
+        return 2;
+
+    case ID_MPU9150_IMU:
+        return 14;
+
+    case ID_MPU9150_IMU_PACK:
+        return SENSOR_LOG_SIZE_VARIABLE;
+
+    default:
+        return 0;
+    }
+}
+
+uint8_t sensor_log_decode_delta( const uint8_t *data, uint8_t size, int32_t *delta )
+{
+    /* 下位7bitずつ ( MSBが続き ) -> zigzag */
+    uint32_t value = 0;
+    uint8_t i;
+
+    for ( i = 0; i < size && i < SENSOR_LOG_VARINT_MAX; i++ ) {
+        value |= (uint32_t)( data[i] & 0x7F ) << ( 7 * i );
+
+        if ( !( data[i] & 0x80 ) ) {
+            /* 5バイト目は4bitまで */
+            if ( i == SENSOR_LOG_VARINT_MAX - 1 && data[i] > 0x0F ) {
+                return 0;
+            }
+
+            *delta = (int32_t)( value >> 1 ) ^ -(int32_t)( value & 1 );
+
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static char sensor_log_read_v1( SensorLogReader *reader, SensorLogRecord *record )
+{
+    /* シグネチャ, 時刻, ID, サイズ, データ */
+    uint8_t header[6];
+
+    if ( fgetc( reader->fp ) != LOG_SIGNATURE ) {
+        return 0;
+    }
+
+    if ( fread( header, 1, 6, reader->fp ) != 6 ) {
+        return 0;
+    }
+
+    record->clock = (uint32_t)header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+    record->id    = header[4];
+    record->size  = header[5];
+
+    return ( fread( record->data, 1, record->size, reader->fp ) == record->size );
+}
+
+static char sensor_log_read_v2( SensorLogReader *reader, SensorLogRecord *record )
+{
+    /* 時刻同期は読み飛ばして次のレコード */
+    uint8_t buffer[SENSOR_LOG_VARINT_MAX];
+    uint32_t clock;
+    int32_t delta;
+    int c;
+    int i;
+
+    /* 戻したIMUブロックの残り */
+    if ( sensor_log_pack_next( reader, record ) ) {
+        return 1;
+    }
+
+    while ( 1 ) {
+        c = fgetc( reader->fp );
+
+        if ( c == LOG_V2_SYNC ) {
+            if ( fread( buffer, 1, 4, reader->fp ) != 4 ) {
+                return 0;
+            }
+
+            clock = (uint32_t)buffer[0] | (uint32_t)buffer[1] << 8 | (uint32_t)buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+
+            for ( i = 0; i < DEVICE_COUNT; i++ ) {
+                reader->clocks[i] = clock;
+            }
+
+            for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+                reader->pack_prev[i] = 0;
+            }
+
+            reader->synced = 1;
+            continue;
+        }
+
+        if ( c < 0 || ( c & 0xF0 ) != LOG_V2_RECORD ) {
+            return 0;
+        }
+
+        record->id   = c & 0x0F;
+        record->size = sensor_log_size( record->id );
+
+        /* 同期前のレコードは時刻がわからない */
+        if ( record->id >= DEVICE_COUNT || record->size == 0 || !reader->synced ) {
+            return 0;
+        }
+
+        /* 時刻の差 */
+        for ( i = 0; i < SENSOR_LOG_VARINT_MAX; i++ ) {
+            if ( ( c = fgetc( reader->fp ) ) < 0 ) {
+                return 0;
+            }
+
+            buffer[i] = c;
+
+            if ( !( c & 0x80 ) ) {
+                break;
+            }
+        }
+
+        if ( !sensor_log_decode_delta( buffer, i + 1, &delta ) ) {
+            return 0;
+        }
+
+        reader->clocks[record->id] += delta;
+        record->clock = reader->clocks[record->id];
+
+        /* サイズ付きのレコード */
+        if ( record->size == SENSOR_LOG_SIZE_VARIABLE ) {
+            if ( ( c = fgetc( reader->fp ) ) < 0 ) {
+                return 0;
+            }
+
+            record->size = c;
+        }
+
+        if ( fread( record->data, 1, record->size, reader->fp ) != record->size ) {
+            return 0;
+        }
+
+        if ( record->id == ID_MPU9150_IMU_PACK ) {
+            return sensor_log_unpack( reader, record->data, record->size ) && sensor_log_pack_next( reader, record );
+        }
+
+        return 1;
+    }
+}
+
+static char sensor_log_unpack( SensorLogReader *reader, const uint8_t *data, uint8_t size )
+{
+    /* imu_pack_finishの逆 ( フレーム数, 時間, ビット数, 値 ) */
+    const uint8_t *end = data + size;
+    uint8_t widths[IMU_PACK_CHANNELS];
+    uint32_t bits = 0;
+    uint16_t value;
+    uint8_t count = 0;
+    uint8_t i, j;
+
+    if ( size < 2 || data[0] == 0 || data[0] > IMU_PACK_FRAMES ) {
+        return 0;
+    }
+
+    reader->pack_frames = *data++;
+    reader->pack_next   = 0;
+    reader->pack_clock  = reader->clocks[ID_MPU9150_IMU_PACK];
+    reader->pack_span   = 0;
+
+    for ( i = 0; i < SENSOR_LOG_VARINT_MAX && data < end; i++ ) {
+        reader->pack_span |= (uint32_t)( *data & 0x7F ) << ( 7 * i );
+
+        if ( !( *data++ & 0x80 ) ) {
+            break;
+        }
+    }
+
+    if ( end - data < IMU_PACK_WIDTH_SIZE ) {
+        return 0;
+    }
+
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        widths[i] = ( data[i / 2] >> ( ( i & 1 ) * 4 ) ) & 0x0F;
+
+        if ( widths[i] == 15 ) {
+            widths[i] = 16;
+        }
+    }
+
+    data += IMU_PACK_WIDTH_SIZE;
+
+    for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+        for ( j = 0; j < reader->pack_frames; j++ ) {
+            while ( count < widths[i] ) {
+                if ( data >= end ) {
+                    return 0;
+                }
+
+                bits  |= (uint32_t)*data++ << count;
+                count += 8;
+            }
+
+            value  = bits & ( ( 1UL << widths[i] ) - 1 );
+            bits >>= widths[i];
+            count -= widths[i];
+
+            /* zigzag -> 前の値との差 */
+            value = ( value >> 1 ) ^ -( value & 1 );
+            reader->pack_prev[i] += value;
+            reader->pack_values[j][i] = reader->pack_prev[i];
+        }
+    }
+
+    return 1;
+}
+
+static char sensor_log_pack_next( SensorLogReader *reader, SensorLogRecord *record )
+{
+    /* 戻したブロックから次のフレームを ( 時刻は最初と最後の間を等分 ) */
+    uint8_t n = reader->pack_frames;
+    uint8_t i;
+
+    if ( reader->pack_next >= n ) {
+        return 0;
+    }
+
+    i = reader->pack_next++;
+
+    record->clock = reader->pack_clock + ( ( n > 1 ) ? (uint32_t)( (uint64_t)reader->pack_span * i / ( n - 1 ) ) : 0 );
+    record->id    = ID_MPU9150_IMU;
+    record->size  = sensor_log_size( ID_MPU9150_IMU );
+
+    for ( n = 0; n < IMU_PACK_CHANNELS; n++ ) {
+        record->data[n * 2]     = reader->pack_values[i][n];
+        record->data[n * 2 + 1] = (uint16_t)reader->pack_values[i][n] >> 8;
+    }
+
+    return 1;
+}
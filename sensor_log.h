@@ -0,0 +1,65 @@
+/*
+ * sensor3 ログ読み込み ( PC用 )
+ *
+ * micomfs_tool extractで取り出したログファイル ( v1, v2 ) を先頭から1レコードずつ読みます．
+ * v2の時刻はIDごとの差から絶対時刻に戻し，データサイズもIDから決めるので，
+ * 呼び出し側はv1と同じ ( 時刻, ID, サイズ, データ ) として扱えます．
+ * 圧縮したIMUブロック ( ID_MPU9150_IMU_PACK ) は戻して1フレームずつID_MPU9150_IMUのレコードとして返します．
+ *
+ */
+
+#ifndef SENSOR_LOG_H_INCLUDED
+#define SENSOR_LOG_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include "device_id.h"
+#include "imu_pack.h"
+
+#define SENSOR_LOG_VARINT_MAX 5     /* 32bitのzigzag符号化に必要な最大バイト数 */
+#define SENSOR_LOG_SIZE_VARIABLE 0xFF   /* レコードにサイズが入っているID */
+
+typedef struct SensorLogReader_tag {
+    FILE *fp;
+    uint8_t version;                /* 1か2 */
+    uint8_t devices;                /* 有効デバイス */
+    char synced;                    /* v2: 時刻同期を読んだ */
+    uint32_t clocks[DEVICE_COUNT];  /* v2: IDごとの前の時刻 */
+
+    /* v2: 戻したIMUブロック */
+    int16_t pack_prev[IMU_PACK_CHANNELS];
+    int16_t pack_values[IMU_PACK_FRAMES][IMU_PACK_CHANNELS];
+    uint8_t pack_frames;
+    uint8_t pack_next;
+    uint32_t pack_clock;
+    uint32_t pack_span;
+} SensorLogReader;
+
+typedef struct SensorLogRecord_tag {
+    uint32_t clock;
+    uint8_t id;
+    uint8_t size;
+    uint8_t data[255];
+} SensorLogRecord;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ファイルヘッダーを読んで形式を調べる */
+char sensor_log_open( SensorLogReader *reader, FILE *fp );
+
+/* 次のレコード ( 終了か壊れていれば0 ) */
+char sensor_log_read( SensorLogReader *reader, SensorLogRecord *record );
+
+/* IDごとのデータサイズ ( 0は不明，SENSOR_LOG_SIZE_VARIABLEはレコードにサイズがある ) */
+uint8_t sensor_log_size( uint8_t id );
+
+/* zigzag符号化した時刻の差を戻す．使ったバイト数 ( 壊れていれば0 ) を返す */
+uint8_t sensor_log_decode_delta( const uint8_t *data, uint8_t size, int32_t *delta );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
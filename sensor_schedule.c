@@ -0,0 +1,246 @@
+#include "sensor_schedule.h"
+
+/* PC ( I2C_SIM ) では割り込みがないので割り込み禁止も要らない */
+#ifndef I2C_SIM
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
+
+static uint8_t sensor_lock( void );
+static void sensor_unlock( uint8_t sreg );
+static uint32_t sensor_mpu_frame_clock( SensorPoll *poll, uint32_t now );
+static void sensor_mpu_clear_clocks( SensorPoll *poll );
+
+void schedule_init( SensorSchedule *schedule, uint32_t period_us, uint8_t samples )
+{
+    /* サンプル周期[us]からsamplesサンプルごとに読む予定 */
+    schedule->period   = period_us / SYSTEM_CLOCK_US;
+    schedule->interval = schedule->period * samples;
+    schedule->samples  = samples;
+    schedule->next     = 0;
+    schedule->read     = 0;
+
+    if ( schedule->period == 0 ) {
+        schedule->period = 1;
+    }
+
+    if ( schedule->interval == 0 ) {
+        schedule->interval = 1;
+    }
+}
+
+char schedule_due( SensorSchedule *schedule, uint32_t now )
+{
+    /* 読む時刻になっていれば覚えて次の予定へ ( 遅れすぎたらnowから数え直す ) */
+    if ( (int32_t)( now - schedule->next ) < 0 ) {
+        return 0;
+    }
+
+    schedule->read  = now;
+    schedule->next += schedule->interval;
+
+    if ( (int32_t)( now - schedule->next ) >= 0 ) {
+        schedule->next = now + schedule->interval;
+    }
+
+    return 1;
+}
+
+uint32_t schedule_clock( SensorSchedule *schedule, uint8_t newer )
+{
+    /* 最後に読んだときに一番新しいサンプルからnewer個古いサンプルの時刻 */
+    return schedule->read - (uint32_t)newer * schedule->period;
+}
+
+void sensor_poll_init( SensorPoll *poll, LPS25HUnit *pres, MPU9150Unit *mpu9150, AK8975Unit *mag, char use_int )
+{
+    /*
+     * 読み込み予定 ( 各センサーの設定したサンプルレートから )
+     *  MPU9150 : 1回のバーストに入るフレーム数の3/4ごと ( 遅れてたまった分もバーストの残りで減っていくように，地磁気は補助I2Cで同じフレームに入る )
+     *  LPS25H  : バーストの3/4ごと ( 読むのが少し遅れてもFIFOに残らないように )
+     */
+    uint8_t mpu_samples = MPU9150_FIFO_BUFFER_SIZE / mpu9150->frame_size * 3 / 4;
+
+    poll->pres    = pres;
+    poll->mpu9150 = mpu9150;
+    poll->mag     = mag;
+    poll->use_int = use_int;
+
+    if ( mpu_samples == 0 ) {
+        mpu_samples = 1;
+    }
+
+    schedule_init( &poll->mpu_schedule, mpu9150->sample_period, mpu_samples );
+    schedule_init( &poll->pres_schedule, pres->sample_period, LPS25H_FIFO_BURST * 3 / 4 );
+
+    poll->mpu_clock_head   = 0;
+    poll->mpu_clock_count  = 0;
+    poll->pres_int_clock   = 0;
+    poll->pres_ready       = 0;
+    poll->pres_burst_clock = 0;
+    poll->mpu_overflow     = mpu9150->fifo_overflow;
+    poll->pres_clock       = 0;
+    poll->mpu_clock        = 0;
+}
+
+Devices sensor_poll( SensorPoll *poll, Devices enabled, uint32_t now, char pres_int_level )
+{
+    /* 読み終わったFIFOからサンプルを1つずつ取り出し，なくなったら次を頼む．取り出したデバイスを返す */
+    LPS25HUnit *pres = poll->pres;
+    MPU9150Unit *mpu9150 = poll->mpu9150;
+    Devices updated = 0;
+    uint8_t sreg;
+    char due;
+
+    if ( ( enabled & DEV_PRESS ) && !lps25h_queue_busy( pres ) ) {
+        /* 気圧・温度 ( FIFOから読んだサンプルを1ループ1つずつ，予定の時刻にたまった分をまとめて読む ) */
+        if ( lps25h_fifo_fetch( pres ) ) {
+            updated |= DEV_PRESS | DEV_PRESS_TEMP;
+
+            if ( poll->use_int ) {
+                /* ウォーターマークになった時刻がLPS25H_FIFO_BURST番目のサンプル */
+                poll->pres_clock = poll->pres_burst_clock
+                                 + ( (int8_t)pres->fifo_pos - LPS25H_FIFO_BURST ) * (int32_t)poll->pres_schedule.period;
+            } else {
+                /* 読んだときFIFOにあった一番新しいサンプルから数える */
+                poll->pres_clock = schedule_clock( &poll->pres_schedule, pres->fifo_count - pres->fifo_pos );
+            }
+        } else {
+            if ( poll->use_int ) {
+                /* ウォーターマーク ( ピンがHのままなら読み残しがある ) */
+                sreg = sensor_lock();
+                due  = poll->pres_ready || pres_int_level;
+
+                if ( due ) {
+                    poll->pres_burst_clock = poll->pres_int_clock;
+                    poll->pres_ready       = 0;
+                }
+
+                sensor_unlock( sreg );
+            } else {
+                due = schedule_due( &poll->pres_schedule, now );
+            }
+
+            if ( due ) {
+                lps25h_fifo_queue_read( pres );
+            }
+        }
+    }
+
+    if ( ( enabled & ( DEV_ACC | DEV_GYRO ) ) && !mpu9150_queue_busy( mpu9150 ) ) {
+        /* 加速度・温度・ジャイロ・地磁気 ( FIFOから読んだフレームを1ループ1つずつ，なくなったら次をまとめて読む ) */
+
+        /* FIFOがリセットされたら覚えた時刻とずれるので捨てる ( リセットからここまでに来たフレームの分はずれが残る ) */
+        if ( poll->mpu_overflow != mpu9150->fifo_overflow ) {
+            poll->mpu_overflow = mpu9150->fifo_overflow;
+            sensor_mpu_clear_clocks( poll );
+        }
+
+        if ( mpu9150_fifo_fetch( mpu9150 ) ) {
+            updated |= DEV_ACC | DEV_GYRO | DEV_TEMP;
+
+            if ( poll->use_int ) {
+                poll->mpu_clock = sensor_mpu_frame_clock( poll, now );
+            } else {
+                poll->mpu_clock = schedule_clock( &poll->mpu_schedule, mpu9150->fifo_count / mpu9150->frame_size - mpu9150->fifo_pos );
+            }
+
+            /* 地磁気は新しい測定値が入ったフレームだけ */
+            if ( ( enabled & DEV_MAG ) && ak8975_aux_fetch( poll->mag, mpu9150 ) ) {
+                /* 地磁気補正 */
+                ak8975_calc_adjusted_h( poll->mag );
+
+                updated |= DEV_MAG;
+            }
+        } else {
+            if ( poll->use_int ) {
+                /* データレディーが1回で読む分だけ来たら読む */
+                due = ( poll->mpu_clock_count >= poll->mpu_schedule.samples );
+            } else {
+                due = schedule_due( &poll->mpu_schedule, now );
+            }
+
+            if ( due ) {
+                mpu9150_fifo_queue_read( mpu9150 );
+            }
+        }
+    }
+
+    return updated;
+}
+
+void sensor_poll_mpu_int( SensorPoll *poll, uint32_t clock )
+{
+    /* MPU9150のデータレディー: 1フレームFIFOに入ったので時刻を覚える ( いっぱいなら古いものを捨てる ) */
+    if ( poll->mpu_clock_count >= SENSOR_CLOCK_COUNT ) {
+        poll->mpu_clock_head = ( poll->mpu_clock_head + 1 ) & ( SENSOR_CLOCK_COUNT - 1 );
+        poll->mpu_clock_count--;
+    }
+
+    poll->mpu_clocks[( poll->mpu_clock_head + poll->mpu_clock_count ) & ( SENSOR_CLOCK_COUNT - 1 )] = clock;
+    poll->mpu_clock_count++;
+}
+
+void sensor_poll_pres_int( SensorPoll *poll, uint32_t clock )
+{
+    /* LPS25Hのウォーターマーク */
+    poll->pres_int_clock = clock;
+    poll->pres_ready     = 1;
+}
+
+static uint8_t sensor_lock( void )
+{
+    /* 割り込みで書き換える値を読む間だけ割り込み禁止 */
+#ifndef I2C_SIM
+    uint8_t sreg = SREG;
+
+    cli();
+
+    return sreg;
+#else
+    return 0;
+#endif
+}
+
+static void sensor_unlock( uint8_t sreg )
+{
+    /* 割り込み許可を元に戻す */
+#ifndef I2C_SIM
+    SREG = sreg;
+#else
+    (void)sreg;
+#endif
+}
+
+static uint32_t sensor_mpu_frame_clock( SensorPoll *poll, uint32_t now )
+{
+    /* FIFOから取り出したフレームの時刻 ( 覚えた下位16bitをnowの前後3秒以内として戻す，なければnow ) */
+    uint16_t clock;
+    uint8_t sreg;
+
+    sreg = sensor_lock();
+
+    if ( poll->mpu_clock_count == 0 ) {
+        sensor_unlock( sreg );
+        return now;
+    }
+
+    clock = poll->mpu_clocks[poll->mpu_clock_head];
+    poll->mpu_clock_head = ( poll->mpu_clock_head + 1 ) & ( SENSOR_CLOCK_COUNT - 1 );
+    poll->mpu_clock_count--;
+
+    sensor_unlock( sreg );
+
+    return now + (int16_t)( clock - (uint16_t)now );
+}
+
+static void sensor_mpu_clear_clocks( SensorPoll *poll )
+{
+    /* FIFOがリセットされたので覚えた時刻を捨てる */
+    uint8_t sreg;
+
+    sreg = sensor_lock();
+    poll->mpu_clock_head  = 0;
+    poll->mpu_clock_count = 0;
+    sensor_unlock( sreg );
+}
@@ -0,0 +1,89 @@
+/*
+ * センサーの読み込み予定とサンプルの時刻 ( main.cとsensor_sim.cで共通 )
+ *
+ * 時刻はすべてsystem_clock ( SYSTEM_CLOCK_USごと ) 単位です．
+ *
+ * 読み込み予定
+ *  SensorScheduleはサンプル周期とsamplesサンプルごとに読む間隔を持ち，schedule_due()で読む時刻になったか調べます．
+ *  割り込みピンを使わないときは，読んだ時刻からFIFOに残っていたサンプル数 * 周期を引いてサンプルの時刻にします．
+ *
+ * メインループのセンサー読み込み
+ *  sensor_poll()を毎ループ呼ぶと，TWI割り込みで読み終わったFIFOからサンプルを1つずつ取り出し，
+ *  なくなったら予定 ( 割り込みピンを使うならデータレディーとウォーターマーク ) に合わせて次の読み込みをキューに入れます．
+ *  新しく取り出したデバイスを返し，時刻はpres_clock / mpu_clockに入ります．
+ *
+ * 割り込みピン ( use_int )
+ *  MPU9150 : サンプルごとのパルスでsensor_poll_mpu_int()を呼ぶと，時刻を覚えてFIFOのフレームに順に付けます．
+ *  LPS25H  : ウォーターマークでsensor_poll_pres_int()を呼ぶと，その時刻をLPS25H_FIFO_BURST番目のサンプルにします．
+ *  どちらも割り込み中に呼びます．AVRではsensor_poll()の中で覚えた時刻を割り込み禁止で取り出します．
+ *
+ */
+
+#ifndef SENSOR_SCHEDULE_H_INCLUDED
+#define SENSOR_SCHEDULE_H_INCLUDED
+
+#include <stdint.h>
+#include "device_id.h"
+#include "mpu9150.h"
+#include "ak8975.h"
+#include "lps25h.h"
+
+#define SYSTEM_CLOCK_US     100     /* system_clockの1カウント[us] */
+#define SENSOR_CLOCK_COUNT  64      /* 覚えておくフレームの時刻の数 ( 2のべき乗，FIFOに入る46フレームより多く ) */
+
+/* センサーごとの読み込み予定 */
+typedef struct {
+    uint32_t period;        /* サンプル周期 */
+    uint32_t interval;      /* 読む間隔 ( samplesサンプル分 ) */
+    uint32_t next;          /* 次に読む時刻 */
+    uint32_t read;          /* 最後に読んだ時刻 */
+    uint8_t  samples;       /* 1回で読むサンプル数 */
+} SensorSchedule;
+
+/* メインループのセンサー読み込み */
+typedef struct {
+    LPS25HUnit  *pres;
+    MPU9150Unit *mpu9150;
+    AK8975Unit  *mag;
+    char use_int;                       /* 割り込みピンを使う */
+
+    SensorSchedule pres_schedule;
+    SensorSchedule mpu_schedule;
+
+    /* 割り込みで覚えた時刻 */
+    volatile uint16_t mpu_clocks[SENSOR_CLOCK_COUNT];   /* FIFOのフレームごとの時刻 ( 下位16bit ) */
+    volatile uint8_t mpu_clock_head;
+    volatile uint8_t mpu_clock_count;
+    volatile uint32_t pres_int_clock;   /* ウォーターマークになった時刻 */
+    volatile char pres_ready;
+
+    uint32_t pres_burst_clock;          /* 読んでいるバーストのウォーターマークの時刻 */
+    uint16_t mpu_overflow;              /* 最後に見たfifo_overflow */
+
+    /* 最後に取り出したサンプルの時刻 */
+    uint32_t pres_clock;
+    uint32_t mpu_clock;
+} SensorPoll;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 読み込み予定 */
+void schedule_init( SensorSchedule *schedule, uint32_t period_us, uint8_t samples );
+char schedule_due( SensorSchedule *schedule, uint32_t now );                /* 読む時刻なら1 ( 時刻を覚えて次へ ) */
+uint32_t schedule_clock( SensorSchedule *schedule, uint8_t newer );        /* 最後に読んだときnewer個新しいサンプルがあったサンプルの時刻 */
+
+/* メインループのセンサー読み込み ( 初期化したセンサーのサンプル周期から予定を作る ) */
+void sensor_poll_init( SensorPoll *poll, LPS25HUnit *pres, MPU9150Unit *mpu9150, AK8975Unit *mag, char use_int );
+Devices sensor_poll( SensorPoll *poll, Devices enabled, uint32_t now, char pres_int_level );
+
+/* 割り込みから呼ぶ */
+void sensor_poll_mpu_int( SensorPoll *poll, uint32_t clock );
+void sensor_poll_pres_int( SensorPoll *poll, uint32_t clock );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,643 @@
+/*
+ * sensor3 センサー読み込みベンチマーク ( PC用 )
+ *
+ * i2c_sim.cの仮想デバイスに対して，main.cと同じ初期化とメインループのセンサー読み込みを仮想時間で回し，
+ * ループの回転数，センサーごとに記録できたレコード数，読まれる前に上書きされたサンプル数を表示します．
+ * 仮想時間なので何度実行しても同じ結果になります．
+ * IMUフレームはimu_pack.cで圧縮した場合のログも一時ファイルに書き，sensor_log.cで読み戻して元と同じか確かめます．
+ *
+ * 読み込み予定と時刻の付け方はmain.cと同じsensor_schedule.cを使います．
+ *
+ * SDへの書き込みはsd_stage.cの2面バッファーを真似て，CPU時間だけを数えます．
+ * 1ループでSD_ASYNC_STEPバイト ( -s ) ずつ1バイト16サイクルで送り，送り終わったらカードのビジー ( -b ) の間は
+ * 1ループ1バイトだけ見ます．その間もI2Cのキューは進むので，SDの送信とセンサーの読み込みが重なるかを見られます．
+ *
+ * 使い方
+ *  sensor_sim [-i] [-t SECONDS] [-f I2C_HZ] [-d SMPLRT_DIV] [-l LOOP_US] [-w WRITE_US] [-s SD_STEP] [-b SD_BUSY_US] [-r LOG]
+ *   -i 割り込みピンを使う ( main.cのSENSOR_INT )
+ *   -t 測定時間[s] ( 10 )
+ *   -f I2Cバス周波数[Hz] ( 400000 )
+ *   -d MPU9150のサンプルレートディバイダー ( 7 )
+ *   -l 1ループのCPU時間[us] ( 20 )
+ *   -w 1レコードの書き込み時間[us] ( 40 )
+ *   -s SDに1ループで送るバイト数 ( 32，sd.hのSD_ASYNC_STEP．512なら1ループで1セクター全部 )
+ *   -b SDカードの1セクターのビジー時間[us] ( 1000 )
+ *   -r 記録したログファイル ( micomfs_tool extractで取り出したもの ) を波形として使う
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "i2c_sim.h"
+#include "mpu9150.h"
+#include "ak8975.h"
+#include "lps25h.h"
+#include "device_id.h"
+#include "sensor_log.h"
+#include "imu_pack.h"
+#include "sensor_schedule.h"
+
+#define SIM_SD_SECTOR_SIZE  512
+#define SIM_RECORD_HEADER   2       /* IDと時刻の差 ( 大抵1バイト ) */
+#define SIM_SPI_BYTE_NS     ( 16 * 1000000000ULL / F_CPU )     /* SPIOscDiv2で1バイト */
+
+/* SDへの書き込み ( sd_stage.cとsd.cの非同期ブロックライトの真似 ) */
+typedef enum SimSDState_tag {
+    SimSDIdle,
+    SimSDData,
+    SimSDBusy,
+} SimSDState;
+
+typedef struct SimSD_tag {
+    uint16_t step;          /* 1ループで送るバイト数 */
+    uint64_t busy_ns;       /* 1セクターのビジー時間 */
+    uint16_t pos;           /* ためているバッファーのバイト数 */
+    char flushing;          /* もう一方を書き込み中 */
+    SimSDState state;
+    uint16_t sent;
+    uint64_t busy_until;
+    uint32_t blocks;        /* 書き終わったセクター数 */
+    uint32_t dropped;       /* 落としたレコード数 */
+    uint64_t cpu_ns;        /* SDに使ったCPU時間 */
+} SimSD;
+
+/* 記録波形 */
+typedef struct SimWave_tag {
+    int32_t *values;
+    uint32_t count;
+    uint32_t capacity;
+} SimWave;
+
+static SimWave waves[I2C_SIM_CHANNEL_COUNT];
+
+/* 圧縮したIMUのログ ( main.cのLOG_PACK ) と，読み戻して比べる元のフレーム */
+typedef struct SimFrame_tag {
+    uint32_t clock;
+    int16_t values[IMU_PACK_CHANNELS];
+} SimFrame;
+
+static SimFrame *frames;
+static uint32_t frame_count;
+static uint32_t frame_capacity;
+static ImuPack imu_pack;
+static FILE *pack_fp;
+static uint32_t pack_clocks[DEVICE_COUNT];
+static uint32_t pack_sync_clock;
+
+/* センサー読み込み ( 割り込みで覚えた時刻も ) */
+static SensorPoll sensor;
+
+static void sensor_int( I2CSimDeviceType type, uint64_t t )
+{
+    /* 割り込みピンが立った ( main.cのINT1_vect, PCINT2_vect ) */
+    uint32_t clock = t / ( SYSTEM_CLOCK_US * 1000 );
+
+    if ( type == I2CSimMPU9150 ) {
+        sensor_poll_mpu_int( &sensor, clock );
+    } else if ( type == I2CSimLPS25H ) {
+        sensor_poll_pres_int( &sensor, clock );
+    }
+}
+
+static void sd_sim_write( SimSD *sd, uint16_t count )
+{
+    /* 1レコードためる ( sd_stage_writeと同じく，入らないのにもう一方が書き込み中なら落とす ) */
+    if ( sd->pos + count > SIM_SD_SECTOR_SIZE && sd->flushing ) {
+        sd->dropped++;
+        return;
+    }
+
+    sd->pos += count;
+
+    if ( sd->pos >= SIM_SD_SECTOR_SIZE && !sd->flushing ) {
+        sd->pos     -= SIM_SD_SECTOR_SIZE;
+        sd->flushing = 1;
+        sd->state    = SimSDData;
+        sd->sent     = 0;
+    }
+}
+
+static uint64_t sd_sim_process( SimSD *sd, uint64_t now )
+{
+    /* sd_stage_processを1回 ( 使ったCPU時間[ns]を返す ) */
+    uint64_t cost = 0;
+    uint16_t n;
+
+    switch ( sd->state ) {
+    case SimSDData:
+        /* SD_ASYNC_STEPバイト，送り終わったらCRCとデータレスポンスの3バイト */
+        n = SIM_SD_SECTOR_SIZE - sd->sent;
+
+        if ( n > sd->step ) {
+            n = sd->step;
+        }
+
+        sd->sent += n;
+        cost      = n * SIM_SPI_BYTE_NS;
+
+        if ( sd->sent == SIM_SD_SECTOR_SIZE ) {
+            cost          += 3 * SIM_SPI_BYTE_NS;
+            sd->state      = SimSDBusy;
+            sd->busy_until = now + cost + sd->busy_ns;
+        }
+        break;
+
+    case SimSDBusy:
+        /* ビジーを1バイトだけ見る */
+        cost = SIM_SPI_BYTE_NS;
+
+        if ( now + cost >= sd->busy_until ) {
+            sd->state    = SimSDIdle;
+            sd->flushing = 0;
+            sd->blocks++;
+
+            /* 次のバッファーが埋まっていればすぐ始める */
+            if ( sd->pos >= SIM_SD_SECTOR_SIZE ) {
+                sd_sim_write( sd, 0 );
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    sd->cpu_ns += cost;
+
+    return cost;
+}
+
+static int16_t le16( const uint8_t *p )
+{
+    return (int16_t)( p[0] | ( p[1] << 8 ) );
+}
+
+static void pack_sync( uint32_t clock )
+{
+    /* 時刻同期 ( main.cのrecord_sync ) */
+    int i;
+
+    for ( i = 0; i < DEVICE_COUNT; i++ ) {
+        pack_clocks[i] = clock;
+    }
+
+    pack_sync_clock = clock;
+    imu_pack_reset( &imu_pack );
+
+    fputc( LOG_V2_SYNC, pack_fp );
+
+    for ( i = 0; i < 4; i++ ) {
+        fputc( clock >> ( i * 8 ), pack_fp );
+    }
+}
+
+static void pack_write( void )
+{
+    /* たまったブロックを書く ( main.cのrecord_write_pack ) */
+    uint8_t *data;
+    uint8_t size;
+    int32_t delta;
+    uint32_t value;
+
+    if ( !imu_pack.frames ) {
+        return;
+    }
+
+    data  = imu_pack_finish( &imu_pack, &size );
+    delta = imu_pack.first_clock - pack_clocks[ID_MPU9150_IMU_PACK];
+    pack_clocks[ID_MPU9150_IMU_PACK] = imu_pack.first_clock;
+    value = ( (uint32_t)delta << 1 ) ^ (uint32_t)( delta >> 31 );
+
+    fputc( LOG_V2_RECORD | ID_MPU9150_IMU_PACK, pack_fp );
+
+    while ( value >= 0x80 ) {
+        fputc( value | 0x80, pack_fp );
+        value >>= 7;
+    }
+
+    fputc( value, pack_fp );
+    fputc( size, pack_fp );
+    fwrite( data, 1, size, pack_fp );
+}
+
+static void pack_frame( uint32_t now, uint32_t clock, const MPU9150Unit *mpu9150 )
+{
+    /* 1フレームを覚えて圧縮器へ */
+    SimFrame *frame;
+
+    if ( frame_count == frame_capacity ) {
+        frame_capacity = ( frame_capacity ) ? frame_capacity * 2 : 4096;
+        frames = realloc( frames, frame_capacity * sizeof( SimFrame ) );
+
+        if ( frames == NULL ) {
+            perror( "realloc" );
+            exit( 1 );
+        }
+    }
+
+    frame = &frames[frame_count++];
+    frame->clock     = clock;
+    frame->values[0] = mpu9150->acc_x;
+    frame->values[1] = mpu9150->acc_y;
+    frame->values[2] = mpu9150->acc_z;
+    frame->values[3] = mpu9150->gyro_x;
+    frame->values[4] = mpu9150->gyro_y;
+    frame->values[5] = mpu9150->gyro_z;
+    frame->values[6] = mpu9150->temp;
+
+    if ( now - pack_sync_clock >= 10000 ) {
+        pack_sync( now );
+    }
+
+    if ( !imu_pack_regular( &imu_pack, clock ) ) {
+        pack_write();
+    }
+
+    if ( imu_pack_add( &imu_pack, clock, frame->values ) ) {
+        pack_write();
+    }
+}
+
+static void pack_check( void )
+{
+    /* 読み戻して元のフレームと比べる */
+    SensorLogReader reader;
+    SensorLogRecord record;
+    uint32_t n = 0;
+    uint32_t mismatch = 0;
+    int32_t error;
+    int32_t max_error = 0;
+    long bytes;
+    int i;
+
+    pack_write();
+    fputc( LOG_END_SIGNATURE, pack_fp );
+
+    bytes = ftell( pack_fp );
+    rewind( pack_fp );
+
+    if ( !sensor_log_open( &reader, pack_fp ) ) {
+        printf( "imu pack: cannot read back\n" );
+        return;
+    }
+
+    while ( sensor_log_read( &reader, &record ) ) {
+        if ( record.id != ID_MPU9150_IMU || n >= frame_count ) {
+            mismatch++;
+            continue;
+        }
+
+        for ( i = 0; i < IMU_PACK_CHANNELS; i++ ) {
+            if ( le16( &record.data[i * 2] ) != frames[n].values[i] ) {
+                mismatch++;
+                break;
+            }
+        }
+
+        error = record.clock - frames[n].clock;
+
+        if ( abs( error ) > max_error ) {
+            max_error = abs( error );
+        }
+
+        n++;
+    }
+
+    mismatch += frame_count - n;
+
+    printf( "imu pack %.2f bytes/frame (raw %d, ratio %.2f), %u frames, %u mismatches, max clock error %d ticks\n",
+            frame_count ? (double)bytes / frame_count : 0.0, 2 + sensor_log_size( ID_MPU9150_IMU ),
+            bytes ? ( 2.0 + sensor_log_size( ID_MPU9150_IMU ) ) * frame_count / bytes : 0.0,
+            frame_count, mismatch, max_error );
+}
+
+static void usage( void )
+{
+    fprintf( stderr, "usage: sensor_sim [-i] [-t SECONDS] [-f I2C_HZ] [-d SMPLRT_DIV] [-l LOOP_US] [-w WRITE_US] [-s SD_STEP] [-b SD_BUSY_US] [-r LOG]\n" );
+    exit( 2 );
+}
+
+static void wave_push( I2CSimChannel channel, int32_t value )
+{
+    /* 記録波形に1サンプル追加 */
+    SimWave *wave = &waves[channel];
+
+    if ( wave->count == wave->capacity ) {
+        wave->capacity = ( wave->capacity ) ? wave->capacity * 2 : 1024;
+        wave->values   = realloc( wave->values, wave->capacity * sizeof( int32_t ) );
+
+        if ( wave->values == NULL ) {
+            perror( "realloc" );
+            exit( 1 );
+        }
+    }
+
+    wave->values[wave->count++] = value;
+}
+
+static int load_log( const char *path )
+{
+    /* ログファイルを読んで記録波形にする */
+    FILE *fp;
+    SensorLogReader reader;
+    SensorLogRecord record;
+    int i;
+
+    fp = fopen( path, "rb" );
+
+    if ( fp == NULL ) {
+        perror( path );
+        return 0;
+    }
+
+    /* ファイルヘッダー */
+    if ( !sensor_log_open( &reader, fp ) ) {
+        fprintf( stderr, "%s: not a sensor3 log\n", path );
+        fclose( fp );
+        return 0;
+    }
+
+    while ( sensor_log_read( &reader, &record ) ) {
+        if ( record.size != sensor_log_size( record.id ) ) {
+            continue;
+        }
+
+        switch ( record.id ) {
+        case ID_MPU9150_ACC:
+            for ( i = 0; i < 3; i++ ) {
+                wave_push( I2CSimAccX + i, le16( &record.data[i * 2] ) );
+            }
+            break;
+
+        case ID_MPU9150_GYRO:
+            for ( i = 0; i < 3; i++ ) {
+                wave_push( I2CSimGyroX + i, le16( &record.data[i * 2] ) );
+            }
+            break;
+
+        case ID_MPU9150_TEMP:
+            wave_push( I2CSimTemp, le16( record.data ) );
+            break;
+
+        case ID_MPU9150_IMU:
+            /* 加速度, ジャイロ, 温度 */
+            for ( i = 0; i < 3; i++ ) {
+                wave_push( I2CSimAccX + i, le16( &record.data[i * 2] ) );
+                wave_push( I2CSimGyroX + i, le16( &record.data[6 + i * 2] ) );
+            }
+
+            wave_push( I2CSimTemp, le16( &record.data[12] ) );
+            break;
+
+        case ID_AK8975:
+            for ( i = 0; i < 3; i++ ) {
+                wave_push( I2CSimMagX + i, le16( &record.data[i * 2] ) );
+            }
+            break;
+
+        case ID_LPS331AP:
+            wave_push( I2CSimPressure, (int32_t)( record.data[0] | ( record.data[1] << 8 ) | ( record.data[2] << 16 ) | ( (uint32_t)record.data[3] << 24 ) ) );
+            break;
+
+        case ID_LPS331AP_TEMP:
+            wave_push( I2CSimPressureTemp, le16( record.data ) );
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    fclose( fp );
+
+    for ( i = 0; i < I2C_SIM_CHANNEL_COUNT; i++ ) {
+        i2c_sim_set_waveform( i, waves[i].values, waves[i].count );
+    }
+
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    /* main.cのセンサー読み込みを仮想時間で回す */
+    double seconds = 10.0;
+    uint32_t frequency = 400000UL;
+    int divider = 7;
+    uint64_t loop_ns  = 20000;
+    uint64_t write_ns = 40000;
+    SimSD sd;
+    uint64_t loop_cost;
+    uint64_t max_loop = 0;
+    const char *log_path = NULL;
+    int use_int = 0;
+    int opt;
+
+    LPS25HUnit pres;
+    AK8975Unit mag;
+    MPU9150Unit mpu9150;
+
+    Devices enabled_dev = 0;
+    Devices updated_dev;
+    uint32_t records[DEVICE_COUNT] = { 0 };
+    I2CSimStats start[I2C_SIM_DEVICE_COUNT];
+    const I2CSimStats *stats;
+    static const char *names[I2C_SIM_DEVICE_COUNT] = { "mpu9150", "ak8975", "lps25h" };
+    uint64_t start_time;
+    uint64_t end_time;
+    uint64_t start_busy;
+    uint64_t iterations = 0;
+    uint32_t now;
+    uint32_t mpu_last = 0;
+    uint32_t pres_last = 0;
+    uint32_t mpu_jitter = 0;
+    uint32_t pres_jitter = 0;
+    double elapsed;
+    int count;
+    int i;
+
+    memset( &sd, 0, sizeof( sd ) );
+    sd.step    = 32;
+    sd.busy_ns = 1000000;
+
+    while ( ( opt = getopt( argc, argv, "it:f:d:l:w:s:b:r:" ) ) != -1 ) {
+        switch ( opt ) {
+        case 't': seconds   = atof( optarg ); break;
+        case 'f': frequency = strtoul( optarg, NULL, 0 ); break;
+        case 'd': divider   = atoi( optarg ); break;
+        case 'l': loop_ns   = atof( optarg ) * 1000; break;
+        case 'w': write_ns  = atof( optarg ) * 1000; break;
+        case 's': sd.step   = atoi( optarg ); break;
+        case 'b': sd.busy_ns = atof( optarg ) * 1000; break;
+        case 'r': log_path  = optarg; break;
+        case 'i': use_int   = 1; break;
+        default: usage();
+        }
+    }
+
+    if ( optind != argc || seconds <= 0 || divider < 0 || divider > 255 || sd.step < 1 || sd.step > SIM_SD_SECTOR_SIZE ) {
+        usage();
+    }
+
+    i2c_sim_reset();
+
+    if ( log_path && !load_log( log_path ) ) {
+        return 1;
+    }
+
+    /* main.cと同じ初期化 */
+    i2c_init_master( frequency, 0, 0 );
+
+    if ( mpu9150_init( &mpu9150, 0x68, divider, MPU9150LPFCFG0, MPU9150AccFSR16g, MPU9150AccHPFReset, MPU9150GyroFSR2000DPS )
+         && mpu9150_fifo_enable( &mpu9150 ) ) {
+        enabled_dev |= DEV_GYRO | DEV_ACC | DEV_TEMP;
+    }
+
+    if ( ( enabled_dev & DEV_ACC ) && ak8975_init( &mag, 0x0C ) && ak8975_aux_enable( &mag, &mpu9150, 9 ) ) {
+        enabled_dev |= DEV_MAG;
+    }
+
+    if ( lps25h_init( &pres, 0x5D, LPS25H25_25Hz, LPS25HPresAvg512, LPS25HTempAvg64 )
+         && lps25h_fifo_enable( &pres, LPS25H_FIFO_BURST ) ) {
+        enabled_dev |= DEV_PRESS | DEV_PRESS_TEMP;
+    }
+
+    if ( use_int ) {
+        i2c_sim_set_int_handler( sensor_int );
+
+        if ( ( enabled_dev & DEV_PRESS ) && !lps25h_int_enable( &pres, LPS25HIntWatermark ) ) {
+            enabled_dev &= ~( DEV_PRESS | DEV_PRESS_TEMP );
+        }
+    }
+
+    if ( enabled_dev != ( DEV_MAG | DEV_GYRO | DEV_ACC | DEV_PRESS | DEV_TEMP | DEV_PRESS_TEMP ) ) {
+        fprintf( stderr, "sensor init failed (0x%02x)\n", enabled_dev );
+        return 1;
+    }
+
+    lps25h_start( &pres );
+
+    sensor_poll_init( &sensor, &pres, &mpu9150, &mag, use_int );
+
+    /* 圧縮したIMUのログ ( ヘッダーと最初の時刻同期 ) */
+    pack_fp = tmpfile();
+
+    if ( pack_fp == NULL ) {
+        perror( "tmpfile" );
+        return 1;
+    }
+
+    imu_pack_init( &imu_pack );
+    fputc( DEVICE_LOG_V2_SIGNATURE, pack_fp );
+    fputc( enabled_dev, pack_fp );
+    pack_sync( 0 );
+
+    /* ここから測定 */
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        start[i] = *i2c_sim_stats( i );
+    }
+
+    start_time = i2c_sim_now();
+    start_busy = i2c_sim_bus_busy();
+    end_time   = start_time + (uint64_t)( seconds * 1e9 );
+
+    while ( i2c_sim_now() < end_time ) {
+        /* I2Cキューの時間切れ ( main.cと同じ ) */
+        i2c_poll();
+
+        /* センサー情報取得 ( main.cと同じsensor_poll ) */
+        now = ( i2c_sim_now() - start_time ) / ( SYSTEM_CLOCK_US * 1000 );
+        updated_dev = sensor_poll( &sensor, enabled_dev, now, use_int && i2c_sim_int_level( I2CSimLPS25H ) );
+
+        if ( updated_dev & DEV_PRESS ) {
+            /* 時刻の間隔がサンプル周期からずれた分 */
+            if ( pres_last ) {
+                pres_jitter += abs( (int32_t)( sensor.pres_clock - pres_last ) - (int32_t)sensor.pres_schedule.period );
+            }
+
+            pres_last = sensor.pres_clock;
+        }
+
+        if ( updated_dev & DEV_ACC ) {
+            if ( mpu_last ) {
+                mpu_jitter += abs( (int32_t)( sensor.mpu_clock - mpu_last ) - (int32_t)sensor.mpu_schedule.period );
+            }
+
+            mpu_last = sensor.mpu_clock;
+            pack_frame( now, sensor.mpu_clock, &mpu9150 );
+        }
+
+        /* 書き込み ( レコード数だけ時間を使う ) */
+        count = 0;
+
+        if ( updated_dev & DEV_PRESS ) {
+            records[ID_LPS331AP]++;
+            sd_sim_write( &sd, SIM_RECORD_HEADER + 4 );
+            count++;
+        }
+
+        if ( updated_dev & DEV_PRESS_TEMP ) {
+            records[ID_LPS331AP_TEMP]++;
+            sd_sim_write( &sd, SIM_RECORD_HEADER + 2 );
+            count++;
+        }
+
+        if ( updated_dev & ( DEV_ACC | DEV_GYRO | DEV_TEMP ) ) {
+            records[ID_MPU9150_IMU]++;
+            sd_sim_write( &sd, SIM_RECORD_HEADER + 14 );
+            count++;
+        }
+
+        if ( updated_dev & DEV_MAG ) {
+            records[ID_AK8975]++;
+            sd_sim_write( &sd, SIM_RECORD_HEADER + 6 );
+            count++;
+        }
+
+        /* SDへの書き込みを進める ( main.cではセンサーの前，ここではループの終わりにまとめて時間を使う ) */
+        loop_cost  = loop_ns + count * write_ns;
+        loop_cost += sd_sim_process( &sd, i2c_sim_now() + loop_cost );
+
+        if ( loop_cost > max_loop ) {
+            max_loop = loop_cost;
+        }
+
+        i2c_sim_advance( loop_cost );
+        iterations++;
+    }
+
+    /* 結果 */
+    elapsed = ( i2c_sim_now() - start_time ) / 1e9;
+
+    printf( "simulated %.3f s, i2c %u Hz, loop %.1f us, write %.1f us/record\n",
+            elapsed, frequency, loop_ns / 1000.0, write_ns / 1000.0 );
+    printf( "loop iterations %llu (%.0f /s)\n", (unsigned long long)iterations, iterations / elapsed );
+    printf( "records imu %u mag %u press %u press_temp %u\n",
+            records[ID_MPU9150_IMU], records[ID_AK8975], records[ID_LPS331AP], records[ID_LPS331AP_TEMP] );
+
+    printf( "%-8s %10s %10s %10s %8s %10s\n", "device", "produced", "read", "dropped", "drop%", "rate/s" );
+
+    for ( i = 0; i < I2C_SIM_DEVICE_COUNT; i++ ) {
+        stats = i2c_sim_stats( i );
+
+        printf( "%-8s %10u %10u %10u %7.1f%% %10.1f\n", names[i],
+                stats->produced - start[i].produced, stats->read - start[i].read, stats->dropped - start[i].dropped,
+                ( stats->produced - start[i].produced ) ? 100.0 * ( stats->dropped - start[i].dropped ) / ( stats->produced - start[i].produced ) : 0.0,
+                ( stats->read - start[i].read ) / elapsed );
+    }
+
+    printf( "mpu9150 fifo overflows %u, lps25h fifo full %u\n", mpu9150.fifo_overflow, pres.fifo_overflow );
+    printf( "timestamp jitter mpu9150 %.2f ticks, lps25h %.2f ticks (mean |interval - period|, 100us ticks)\n",
+            records[ID_MPU9150_IMU] > 1 ? (double)mpu_jitter / ( records[ID_MPU9150_IMU] - 1 ) : 0.0,
+            records[ID_LPS331AP] > 1 ? (double)pres_jitter / ( records[ID_LPS331AP] - 1 ) : 0.0 );
+    printf( "bus busy %.1f%%\n", 100.0 * ( i2c_sim_bus_busy() - start_busy ) / ( i2c_sim_now() - start_time ) );
+    printf( "sd %u sectors (%.1f /s), step %u bytes, busy %.0f us, dropped records %u, sd cpu %.1f%%, max loop %.1f us\n",
+            sd.blocks, sd.blocks / elapsed, sd.step, sd.busy_ns / 1000.0, sd.dropped,
+            100.0 * sd.cpu_ns / ( i2c_sim_now() - start_time ), max_loop / 1000.0 );
+
+    pack_check();
+    fclose( pack_fp );
+
+    return 0;
+}
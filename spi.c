@@ -127,10 +127,9 @@ void spi_release_slave( void )
     PORTB |= _BV( PB2 );
 }
 
-#if 0
-void spi_auto_master_start( uint8_t *write_data, uint8_t *read_data, size_t size, uint8_t write_const )
+void spi_auto_master_start( const uint8_t *write_data, uint8_t *read_data, size_t size, uint8_t write_const )
 {
-    /* 自動処理実行開始 */
+    /* 自動処理実行開始 ( 最初の1バイトを送る．残りはspi_auto_proccessで進める ) */
     uint8_t data;
 
     unit.read_data   = read_data;
@@ -140,7 +139,7 @@ void spi_auto_master_start( uint8_t *write_data, uint8_t *read_data, size_t size
     unit.pos         = 0;
 
     /* 設定が変なら何もしない */
-    if ( size < 1 ) {
+    if ( size < 1 || unit.side != SPIMaster ) {
         unit.status = SPIError;
         return;
     }
@@ -171,48 +170,47 @@ void spi_auto_master_start( uint8_t *write_data, uint8_t *read_data, size_t size
     spi_write( data );
 }
 
-SPIStatus spi_auto_proccess( void )
+static void spi_auto_step( void )
 {
-    /* 自動処理 */
-    if ( unit.side == SPIMaster ) {
-        /* マスターの自動処理 */
-
-        /* 通信完了したか確認 */
-        if ( spi_complete() ) {
-            /* 完了したので次の処理 */
-
-            /* 読み込み */
-            if ( !unit.rd_NULL ) {
-                unit.read_data[unit.pos] = spi_read();
-            } else {
-                spi_read();
-            }
+    /* 1バイト終わったので次の処理 ( SPIFは解除済み ) */
 
-            /* ポインタを進めて終了確認 */
-            unit.pos++;
-
-            if ( unit.pos == unit.size ) {
-                /* 終了した */
-                unit.status = SPISuccess;
-                return SPISuccess;
-            } else {
-                /* 終わってないので次へ */
-                if ( unit.wd_NULL ) {
-                    spi_write( unit.write_const );
-                } else {
-                    spi_write( unit.write_data[unit.pos] );
-                }
-
-                return SPIWorking;
-            }
+    /* 読み込み */
+    if ( !unit.rd_NULL ) {
+        unit.read_data[unit.pos] = spi_read();
+    } else {
+        spi_read();
+    }
+
+    /* ポインタを進めて終了確認 */
+    unit.pos++;
+
+    if ( unit.pos == unit.size ) {
+        /* 終了した */
+        unit.status = SPISuccess;
+    } else {
+        /* 終わってないので次へ */
+        if ( unit.wd_NULL ) {
+            spi_write( unit.write_const );
         } else {
-            /* 完了してないのでそのまま */
-            return SPIWorking;
+            spi_write( unit.write_data[unit.pos] );
         }
-    } else {
+    }
+}
+
+SPIStatus spi_auto_proccess( size_t count )
+{
+    /* 最大countバイト進める ( 次のバイトはすぐ書くので，待つのは転送の16サイクルだけ ) */
+    if ( unit.side != SPIMaster ) {
         /* スレーブモードの自動処理 ( とりあえずエラー ) */
         return SPIError;
     }
+
+    for ( ; count > 0 && unit.status == SPIWorking; count-- ) {
+        while ( !spi_complete() );
+        spi_auto_step();
+    }
+
+    return unit.status;
 }
 
 SPIStatus spi_auto_complete( void )
@@ -221,6 +219,7 @@ SPIStatus spi_auto_complete( void )
     return unit.status;
 }
 
+#if 0
 SPISpeed spi_bps_to_speed( uint32_t max_bps )
 {
     /* 引数のbpsを最大として最も近いものを探す */
@@ -14,6 +14,12 @@
  * 使える割り込み
  * SPIF : SPI通信の完了を通知．割り込みベクターにより解除される．もしくは，SPSRを読んだ後に，SPDRにアクセスすることで解除される．
  *
+ * 自動処理 ( マスターのみ )
+ * spi_auto_master_startで最初の1バイトを送り，spi_auto_proccess( count )を呼ぶたびに
+ * SPIFを待ちながら最大countバイト送受信を進めます．メインループから少しずつ呼べば，残りの間ほかの処理ができます．
+ * SPIOscDiv2では1バイトが16サイクルで，割り込みの出入りより短いのでバイトごとの割り込みは使いません．
+ * 自動処理中はspi_write / spi_readを使わないでください．
+ *
  */
 
 #ifndef SPI_H_INCLUDED
@@ -68,7 +74,7 @@ typedef enum SPIStatus_tag {
 /* 自動処理用 */
 typedef struct SPIUnit_tag {
     SPISide   side;
-    uint8_t   *write_data;
+    const uint8_t *write_data;
     uint8_t   *read_data;
     size_t    size;
     uint8_t   write_const;
@@ -99,10 +105,10 @@ uint8_t spi_read( void );
 void spi_select_slave( void );
 void spi_release_slave( void );
 
-/* ほぼマスター専用自動処理 */
-//SPIStatus spi_auto_proccess( void );
-//SPIStatus spi_auto_complete( void );
-//void spi_auto_master_start( uint8_t *write_data, uint8_t *read_data, size_t size, uint8_t write_const );
+/* マスター専用自動処理 ( write_dataがNULLならwrite_constを送る，read_dataがNULLなら受信は捨てる ) */
+void spi_auto_master_start( const uint8_t *write_data, uint8_t *read_data, size_t size, uint8_t write_const );
+SPIStatus spi_auto_proccess( size_t count );    /* 最大countバイト進める ( 1バイトごとにSPIFを待つ ) */
+SPIStatus spi_auto_complete( void );
 
 #ifdef __cplusplus
 }
@@ -1,4 +1,23 @@
 #include "usart.h"
+#include "fifo.h"
+
+static Fifo tx_fifo;
+static uint8_t tx_buffer[USART_BUFFER_LENGTH];
+
+ISR( USART_UDRE_vect )
+{
+    /* 送信バッファーから1バイト ( 空なら割り込みを止める ) */
+    uint8_t data;
+
+    if ( fifo_get( &tx_fifo, &data ) ) {
+        UDR0 = data;
+
+        /* 出力完了フラグは最後のバイトを出し終えたときだけ立つように ( FE, DOR, UPEには0を書く ) */
+        UCSR0A = ( UCSR0A & ( _BV( U2X0 ) | _BV( MPCM0 ) ) ) | _BV( TXC0 );
+    } else {
+        UCSR0B &= ~_BV( UDRIE0 );
+    }
+}
 
 void usart_init( unsigned long bps, UsartMode mode_enable, UsartInt interrupt_enable )
 {
@@ -8,6 +27,9 @@ void usart_init( unsigned long bps, UsartMode mode_enable, UsartInt interrupt_en
     /* 一旦停止させる */
     usart_release();
 
+    /* 送信バッファーを空に */
+    fifo_init( &tx_fifo, tx_buffer, USART_BUFFER_LENGTH );
+
     /* ボーレートレジスター計算 */
     if ( mode_enable & Usart2X ) {
         ubrr = F_CPU / ( 8 * bps ) - 1;
@@ -149,6 +171,40 @@ void usart_write( uint8_t data )
     UDR0 = data;
 }
 
+uint8_t usart_write_buf( const void *src, uint8_t count )
+{
+    /* 送信バッファーに入るだけ入れて，DRE割り込みで送る */
+    count = fifo_write( &tx_fifo, src, count );
+
+    if ( count ) {
+        usart_enable_int_dre( 1 );
+    }
+
+    return count;
+}
+
+uint8_t usart_tx_space( void )
+{
+    /* 送信バッファーの空き */
+    return fifo_space( &tx_fifo );
+}
+
+char usart_tx_empty( void )
+{
+    /* 送信バッファーを送り終えた ( 最後のバイトはまだ送信中かもしれない ) */
+    return ( fifo_count( &tx_fifo ) == 0 );
+}
+
+char usart_tx_complete( void )
+{
+    /* 送信バッファーが空で，シフトレジスターからも出力し終えた */
+    if ( usart_tx_empty() && bit_is_set( UCSR0A, TXC0 ) ) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
 uint8_t usart_get_error( void )
 {
     /* エラー情報取得 */
@@ -15,12 +15,16 @@
  * TX  : トランスミッターから出力完了．割り込みベクターで自動解除．
  * RX  : 未読データーがバッファー内にある．バッファーをカラにしなければ割り込み続ける．受信割り込み．
  * DRE : トランスミッターバッファーに受け入れ可能．受け入れ不可能でない限り常に発生する．連続送信に使う．
+ *
+ * usart_write_bufは送信バッファー ( USART_BUFFER_LENGTHバイト ) に入れるだけで待ちません．
+ * バッファーはDRE割り込みで送り出し，空になったらDRE割り込みを止めます．
+ * 送信バッファーに書くのは1か所 ( メインループ ) だけにしてください．usart_writeと混ぜて使えません．
  */
 
 #ifndef USART_H_INCLUDED
 #define USART_H_INCLUDED
 
-#define USART_BUFFER_LENGTH 16
+#define USART_BUFFER_LENGTH 64     /* 送信バッファー ( 2のべき乗，128まで ) */
 
 #include "ide.h"
 #include <stdio.h>
@@ -61,6 +65,12 @@ char usart_can_write( void );
 uint8_t usart_read( void );
 void usart_write( uint8_t data );
 
+/* 送信バッファー */
+uint8_t usart_write_buf( const void *src, uint8_t count );  /* 入った分のバイト数を返す */
+uint8_t usart_tx_space( void );
+char usart_tx_empty( void );
+char usart_tx_complete( void );     /* 最後のバイトまで出力し終えた ( ボーレートを変えてよい ) */
+
 /* エラー処理 */
 uint8_t usart_get_error( void );
 char usart_error_frame( uint8_t error );